@@ -490,6 +490,18 @@ void	TFT_Init_Ili9341(void)
 	write_comm(0x36); // Memory Access Control
 //	write_data(0x08);
 	write_data(0x20);
+
+	write_comm(0x33); // Vertical Scrolling Definition, wave display columns
+	write_data(SCROLL_TFA >> 8);
+	write_data(SCROLL_TFA & 0xFF);
+	write_data(SCROLL_VSA >> 8);
+	write_data(SCROLL_VSA & 0xFF);
+	write_data(SCROLL_BFA >> 8);
+	write_data(SCROLL_BFA & 0xFF);
+
+	write_comm(0x37); // Vertical Scrolling Start Address, not scrolled
+	write_data(SCROLL_TFA >> 8);
+	write_data(SCROLL_TFA & 0xFF);
 	
 	write_comm(0xB1); // Frame Rate Control
 	write_data(0x00);
@@ -21,6 +21,7 @@
 #define	TFT_nRD_Bit			10	
 
 #define	TFT_Port			(GPIOB->ODR)
+#define	TFT_Data_Base			GPIOB		// Data on bits 0..7
 
 #define	LED_Base			GPIOA
 #define	LED_Port			(GPIOA->ODR)
@@ -6,8 +6,15 @@ typedef	unsigned char		U8;
 typedef	signed char		S8;
 typedef	unsigned short int	U16;
 typedef	signed short int	S16;
+#ifdef HOST_TEST
+/* tests/ runs on LP64 hosts, keep the Cortex-M3 widths */
+typedef	unsigned int		U32;
+typedef	signed int		S32;
+#else
 typedef	unsigned long		U32;
 typedef	signed long		S32; 
+#endif
+typedef	unsigned long long	U64;
 
 // -- Control debug code generation
 //#define	_Debug_
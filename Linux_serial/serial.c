@@ -12,82 +12,232 @@
 
 void wf_printf(FILE *plot_file, uint16_t *waveform, uint16_t size, double interval);
 void plot_wf(void);
+void stats_printf(struct frame *fr);
+int run_commands(int fd, struct pending *cmds, uint16_t n, struct frame *fr);
 
 int main(int argc, char *argv[])
 {
-	char *commands[] = { "plus\n", "minus\n", "sel\n", "ok\n", "wave\n", 0 };
-	uint8_t codes[] = { SERIAL_PLUS, SERIAL_MINUS, SERIAL_SEL, SERIAL_SINGLE, SERIAL_SEND_WF };
+	char *commands[] = { "plus", "minus", "sel", "ok", "wave", "stats", 0 };
+	uint8_t codes[] = { PROTO_PLUS, PROTO_MINUS, PROTO_SEL, PROTO_SINGLE, PROTO_SEND_WF, PROTO_SEND_STATS };
 
-	uint8_t comm_code;
-	uint16_t waveform[300];
+	struct pending cmds[CMDS_MAX];
+	struct frame fr;
+	uint16_t waveform[SAMPLES_NR];
+	uint8_t seq = 0;
 	
 	int32_t fd = open_serial_port("/dev/ttyUSB0");
 	set_interface_attribs(fd, 115200);
 	
 	char command_buf[128];
-	uint8_t wr_code = SERIAL_SEL;
 	
-	uint8_t ret;
 	uint16_t tb_us;
 
+	/* Forget the sequence numbers of an earlier session */
+	cmds[0].type = PROTO_RESET;
+	cmds[0].seq = seq++;
+	cmds[0].done = 0;
+	run_commands(fd, cmds, 1, &fr);
+
 	while(1) {
-		uint8_t i = 0;
+		uint16_t n = 0;
 		
 		if(!fgets(command_buf, 128, stdin)) {
 			perror("fgets");
 			exit(EXIT_FAILURE);
 		}
 
-		char **cmd_ptr = commands;
-		while(*cmd_ptr != NULL){
-			if(!strcmp(*cmd_ptr, command_buf))
+		/* Any number of commands on a line, e.g. "plus plus sel" */
+		for(char *word = strtok(command_buf, " \t\n"); word; word = strtok(NULL, " \t\n")) {
+			uint8_t i = 0;
+			char **cmd_ptr = commands;
+			while(*cmd_ptr != NULL){
+				if(!strcmp(*cmd_ptr, word))
+					break;
+				cmd_ptr++;
+				++i;
+			}
+			
+			if(!*cmd_ptr) {
+				printf("Invalid command: %s\n", word);
+				continue;
+			}
+			if(n == CMDS_MAX) {
+				printf("Too many commands.\n");
 				break;
-			cmd_ptr++;
-			++i;
+			}
+			cmds[n].type = codes[i];
+			cmds[n].seq = seq++;
+			cmds[n].done = 0;
+			++n;
 		}
-		
-		if(!*cmd_ptr) {
-			printf("Invalid command.\n");
+
+		if(!run_commands(fd, cmds, n, &fr))
 			continue;
+
+		/* The last waveform answer is left in fr */
+		FILE *plot_file = fopen("plot.dat", "w");
+		if(plot_file == NULL) {
+			perror("fopen");
+			exit(EXIT_FAILURE);
 		}
-		wr_code = codes[i];
-		do {
-			ret = write(fd, &wr_code, 1);
-			if(ret == -1) {
-				perror("write");
-				exit(EXIT_FAILURE);
-			}
+
+		tb_us = get16(fr.payload);
+		printf("%d\n",tb_us);
+		for(uint16_t i = 0; i < SAMPLES_NR; ++i)
+			waveform[i] = get16(fr.payload + 2 + 2 * i);
 		
-			ret = read(fd, &comm_code, 1);
-			if(ret == -1) {
-				perror("read");
-				exit(EXIT_FAILURE);
+		adc_arr_to_mv(waveform, MAXV, SAMPLES_NR);
+		wf_printf(plot_file, waveform, SAMPLES_NR, calc_samp_int(tb_us));
+		fclose(plot_file);
+		plot_wf();
+	}
+	
+}
 
-			}
-		} while(comm_code == RESEND);
+/*
+ * Send the commands with up to PROTO_WINDOW of them unanswered and wait
+ * for all answers. A CRC NAK or a timeout sends a command again, other
+ * NAKs are reported and end the command. Returns 1 if a waveform arrived,
+ * it is left in fr.
+ */
+int run_commands(int fd, struct pending *cmds, uint16_t n, struct frame *fr)
+{
+	uint16_t sent = 0, answered = 0, i;
+	int wave = 0, ret;
 
-		if(comm_code == WF_SENDING){
-			FILE *plot_file = fopen("plot.dat", "w");
-			if(plot_file == NULL) {
-				perror("fopen");
-				exit(EXIT_FAILURE);
-			}
+	while(answered < n) {
+		while(sent < n && sent - answered < PROTO_WINDOW) {
+			send_frame(fd, cmds[sent].type, cmds[sent].seq, NULL, 0);
+			++sent;
+		}
 
-			uart_get16(fd, &tb_us);
-			printf("%d\n",tb_us);
-			get_waveform(fd, waveform);
-			
-			adc_arr_to_mv(waveform, MAXV, SAMPLES_NR);
-			/*for(int i = 0; i < 300; i++)
-				printf("%d\n", waveform[i]);*/
-			wf_printf(plot_file, waveform, SAMPLES_NR, calc_samp_int(tb_us));
-			fclose(plot_file);
-			plot_wf();
+		ret = read_frame(fd, fr);
+		if(ret == 0) {
+			/* Timeout, send the unanswered ones again */
+			for(i = 0; i < sent; ++i)
+				if(!cmds[i].done)
+					send_frame(fd, cmds[i].type, cmds[i].seq, NULL, 0);
+			continue;
 		}
+		if(ret < 0)
+			continue;
+
+		for(i = 0; i < sent; ++i)
+			if(!cmds[i].done && cmds[i].seq == fr->seq)
+				break;
+		if(i == sent)
+			continue;
+
+		switch(fr->type) {
+		case PROTO_NAK:
+			/* Only a damaged frame can succeed when sent again */
+			if(!fr->len || fr->payload[0] == PROTO_ERR_CRC) {
+				send_frame(fd, cmds[i].type, cmds[i].seq, NULL, 0);
+				continue;
+			}
+			if(fr->payload[0] == PROTO_ERR_NO_WF)
+				printf("No single shot capture.\n");
+			else
+				printf("Command 0x%02x refused, error %d\n", cmds[i].type, fr->payload[0]);
+			break;
+		case PROTO_WAVEFORM:
+			if(fr->len != PROTO_WF_LEN)
+				continue;
+			wave = 1;
+			break;
+		case PROTO_STATS:
+			if(fr->len < PROTO_STATS_LEN(0) || fr->len != PROTO_STATS_LEN(fr->payload[2]))
+				continue;
+			stats_printf(fr);
+			break;
+		default:
+			break;
+		}
+
+		cmds[i].done = 1;
+		++answered;
 	}
-	
+
+	return wave;
 }
 
+void send_frame(int fd, uint8_t type, uint8_t seq, const uint8_t *payload, uint16_t len)
+{
+	uint8_t buf[PROTO_HDR_LEN + PROTO_CMD_MAX + PROTO_CRC_LEN];
+	uint16_t crc = PROTO_CRC_INIT, i;
+
+	buf[0] = PROTO_SYNC;
+	buf[1] = len;
+	buf[2] = len >> 8;
+	buf[3] = type;
+	buf[4] = seq;
+	if(len)
+		memcpy(buf + PROTO_HDR_LEN, payload, len);
+	for(i = 1; i < PROTO_HDR_LEN + len; ++i)
+		crc = proto_crc16(crc, buf[i]);
+	buf[i++] = crc;
+	buf[i++] = crc >> 8;
+
+	if(write(fd, buf, i) != i) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* 1 if a byte was read, 0 on a timeout */
+static int read_byte(int fd, uint8_t *b)
+{
+	int ret = read(fd, b, 1);
+
+	if(ret == -1) {
+		perror("read");
+		exit(EXIT_FAILURE);
+	}
+	return ret;
+}
+
+/* 1 if a frame was read, 0 on a timeout, -1 if its CRC is bad */
+int read_frame(int fd, struct frame *fr)
+{
+	uint8_t hdr[PROTO_HDR_LEN], b;
+	uint16_t crc = PROTO_CRC_INIT, crc_rx, i;
+
+	do {
+		if(!read_byte(fd, &b))
+			return 0;
+	} while(b != PROTO_SYNC);
+
+	for(i = 1; i < PROTO_HDR_LEN; ++i) {
+		if(!read_byte(fd, hdr + i))
+			return 0;
+		crc = proto_crc16(crc, hdr[i]);
+	}
+	fr->len = get16(hdr + 1);
+	fr->type = hdr[3];
+	fr->seq = hdr[4];
+	if(fr->len > sizeof(fr->payload))
+		return -1;
+
+	for(i = 0; i < fr->len; ++i) {
+		if(!read_byte(fd, fr->payload + i))
+			return 0;
+		crc = proto_crc16(crc, fr->payload[i]);
+	}
+
+	if(!read_byte(fd, &b))
+		return 0;
+	crc_rx = b;
+	if(!read_byte(fd, &b))
+		return 0;
+	crc_rx |= b << 8;
+
+	return (crc == crc_rx) ? 1 : -1;
+}
+
+uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
 
 int open_serial_port(char* portname)
 {
@@ -124,9 +274,9 @@ int set_interface_attribs(int fd, int speed)
 	tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
 	tty.c_oflag &= ~OPOST;
 
-	/* fetch bytes as they become available */
-	tty.c_cc[VMIN] = 1;
-	tty.c_cc[VTIME] = 100;
+	/* fetch bytes as they become available, time out for the resends */
+	tty.c_cc[VMIN] = 0;
+	tty.c_cc[VTIME] = ANSWER_TIMEOUT;
 
 	if (tcsetattr(fd, TCSANOW, &tty) != 0) {
 		perror("tcsetattr");
@@ -135,35 +285,6 @@ int set_interface_attribs(int fd, int speed)
 	return 0;
 }
 
-void uart_get16(int fd, uint16_t *ptr) 
-{
-	uint8_t res_8;
-	int16_t ret;
-
-	ret = read(fd, &res_8, 1);
-	if(ret == -1) {
-		perror("read");
-		exit(EXIT_FAILURE);
-	}
-	*ptr = res_8;
-	
-	ret = read(fd, &res_8, 1);
-	if(ret == -1) {
-		perror("read");
-		exit(EXIT_FAILURE);
-	}
-	*ptr += (res_8 << 8);	
-	
-}
-
-void get_waveform(int fd, uint16_t * waveform)
-{
-	for(uint16_t i = 0; i < 300; ++i) {
-		uart_get16(fd, waveform + i);
-		//printf("%d\n", waveform[i]);
-	}
-}
-
 double calc_samp_int(uint16_t tb)
 {
 	return ((double)DIV_MULT * tb) / SAMPLES_NR;
@@ -186,6 +307,19 @@ void wf_printf(FILE *plot_file, uint16_t *waveform, uint16_t size, double interv
 		fprintf(plot_file, "%f\t%d\n", i * interval, waveform[i]);
 }
 
+/* Task loads, the names are in the device scheduler order */
+void stats_printf(struct frame *fr)
+{
+	char *tasks[] = { "acquire", "ui", "measure", "trace", "info" };
+	uint8_t *p = fr->payload + PROTO_STATS_LEN(0);
+
+	printf("%d fps, %d%% idle\n", fr->payload[0], fr->payload[1]);
+	for(uint8_t i = 0; i < fr->payload[2]; ++i, p += PROTO_STATS_TASK_LEN)
+		printf("%-8s %3d%% %5d skips %10u cycles max\n",
+			(i < sizeof(tasks) / sizeof(tasks[0])) ? tasks[i] : "?",
+			p[0], get16(p + 1), get16(p + 3) | ((uint32_t)get16(p + 5) << 16));
+}
+
 /* Plot waveform using gnuplot script */
 void plot_wf(void)
 {
@@ -3,31 +3,38 @@
 
 #include <stdint.h>
 
-/* USART Flags */
-#define ACK			0x01
-#define NEED_ACK		0x02
-#define	RESEND			0x03
-#define RX_DONE 		0x04
-#define RX_WAITING		0x05
-
-/* USART Commands */
-#define SERIAL_SEL		0x04
-#define SERIAL_PLUS		0x05
-#define SERIAL_MINUS		0x06
-#define SERIAL_SINGLE		0x07
-#define SERIAL_SEND_WF		0x08
-
-#define WF_SENDING 		0x09
+#include "../protocol.h"
 
 /* ADC parameters */
 #define ADC_RES			4096
 #define MAXV			3300
 #define DIV_MULT		12
-#define SAMPLES_NR 		300
-
-
-void get_waveform(int fd, uint16_t * waveform);
-void uart_get16(int fd, uint16_t *ptr);
+#define SAMPLES_NR 		PROTO_WF_SAMPLES
+
+/* Commands given on one line */
+#define CMDS_MAX		64
+
+/* Answer timeout, tenths of a second, see set_interface_attribs() */
+#define ANSWER_TIMEOUT		5
+
+/* A frame read by read_frame() */
+struct frame {
+	uint8_t type;
+	uint8_t seq;
+	uint16_t len;
+	uint8_t payload[PROTO_WF_LEN];
+};
+
+/* A command waiting for its answer */
+struct pending {
+	uint8_t type;
+	uint8_t seq;
+	uint8_t done;
+};
+
+void send_frame(int fd, uint8_t type, uint8_t seq, const uint8_t *payload, uint16_t len);
+int read_frame(int fd, struct frame *fr);
+uint16_t get16(const uint8_t *p);
 int open_serial_port(char* portname);
 int set_interface_attribs(int fd, int speed);
 uint16_t adc_to_mv(uint16_t adc_val, uint16_t mv_max);
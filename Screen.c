@@ -2,11 +2,20 @@
 #include	"Board.h"
 #include	"Screen.h"
 #include 	"scope.h"
+#include 	"avg.h"
+#include 	"render.h"
+#include 	"freqcnt.h"
+#include 	"measure.h"
+#include 	"fft.h"
+#include 	"loop.h"
 #include 	"string.h"
 #include 	"stdlib.h"
 
 extern struct scope dso_scope;
 extern struct waveform wave;
+extern U8 trig_pos_vals[];
+extern U8 acq_sel_modes[];
+extern struct loop loop;
 
 // ==========================================================
 //	File Scope Variables
@@ -15,6 +24,202 @@ extern struct waveform wave;
 
 static U8 buf[10];
 static U8 freq_delay = 15;
+static U16 scroll_ofs;		/* Hardware scroll offset in columns, 0 in normal mode */
+static U16 vspan_x = 0xFFFF;	/* Column address left by VSpanBegin(), 0xFFFF if unknown */
+
+/* Text last drawn for each info bar label, see label_puts() */
+static struct label {
+	U16 fg, bg;
+	U8 text[LABEL_LEN + 1];
+} labels[LABELS_NR];
+
+// ==========================================================
+//	Bus kernel
+// ==========================================================
+//
+// One BSRR word drives the data byte on PB0..7: the low half sets the one
+// bits, the high half resets all eight (set wins), PB8..15 are untouched.
+// A byte then costs one store plus the nWR strobe, no read-modify-write.
+#define BUS_WORD(b)	(0x00FF0000 | (U8)(b))
+#define BUS_STROBE()	do { TFT_nWR_Port->BRR = (1 << TFT_nWR_Bit); \
+			TFT_nWR_Port->BSRR = (1 << TFT_nWR_Bit); } while(0)
+#define BUS_BYTE(b)	do { TFT_Data_Base->BSRR = BUS_WORD(b); BUS_STROBE(); } while(0)
+#define BUS_PIXEL(hi, lo)	do { TFT_Data_Base->BSRR = (hi); BUS_STROBE(); \
+				TFT_Data_Base->BSRR = (lo); BUS_STROBE(); } while(0)
+
+// Command byte, RS low for it, nCS must be low
+static void bus_comm(U8 comm)
+{
+ SetToLow(TFT_RS_Port, (1 << TFT_RS_Bit));
+ BUS_BYTE(comm);
+ SetToHigh(TFT_RS_Port, (1 << TFT_RS_Bit));
+}
+
+// ==========================================================
+//	DMA streaming
+// ==========================================================
+//
+// TIM4 paces three DMA1 channels, every period moves one bus byte:
+//	CC2    - channel 4 writes the pre-encoded data word to GPIOB BSRR
+//	CC3    - channel 5 writes nWR low to GPIOC BSRR
+//	update - channel 7 writes nWR high, the ILI9341 latches the byte
+// nCS stays low for the whole stream, the channel 7 transfer complete
+// interrupt chains the runs and releases the bus. Everything that drives
+// the bus waits for it with TFT_DMA_Wait() first.
+static const U32 wr_low = (1 << (TFT_nWR_Bit + 16));
+static const U32 wr_high = (1 << TFT_nWR_Bit);
+static U32 dma_words[2 * TFT_GLYPH_MAX];	// Pixels as BSRR words, high byte first
+static U32 dma_left;				// Bus bytes after the current run
+static __IO U8 dma_busy;
+static DMA_InitTypeDef dma_data;
+
+void TFT_DMA_Init(void)
+{
+ TIM_TimeBaseInitTypeDef TIM_struct;
+ TIM_OCInitTypeDef OC_struct;
+ DMA_InitTypeDef DMA_init;
+ NVIC_InitTypeDef NVIC_struct;
+
+ TIM_TimeBaseStructInit(&TIM_struct);
+ TIM_struct.TIM_Period = TFT_DMA_CLKS - 1;
+ TIM_struct.TIM_Prescaler = 0;
+ TIM_struct.TIM_CounterMode = TIM_CounterMode_Up;
+ TIM_TimeBaseInit(TIM4, &TIM_struct);
+
+ TIM_OCStructInit(&OC_struct);
+ OC_struct.TIM_OCMode = TIM_OCMode_Timing;
+ OC_struct.TIM_Pulse = TFT_DMA_DATA_AT;
+ TIM_OC2Init(TIM4, &OC_struct);
+ OC_struct.TIM_Pulse = TFT_DMA_WR_AT;
+ TIM_OC3Init(TIM4, &OC_struct);
+
+ // Data, source and mode are set per stream
+ dma_data.DMA_PeripheralBaseAddr = (U32)&TFT_Data_Base->BSRR;
+ dma_data.DMA_MemoryBaseAddr = (U32)dma_words;
+ dma_data.DMA_DIR = DMA_DIR_PeripheralDST;
+ dma_data.DMA_BufferSize = 2;
+ dma_data.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+ dma_data.DMA_MemoryInc = DMA_MemoryInc_Enable;
+ dma_data.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+ dma_data.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+ dma_data.DMA_Mode = DMA_Mode_Circular;
+ dma_data.DMA_Priority = DMA_Priority_Low;
+ dma_data.DMA_M2M = DMA_M2M_Disable;
+
+ // nWR strobe, one constant word each
+ DMA_init = dma_data;
+ DMA_init.DMA_PeripheralBaseAddr = (U32)&TFT_nWR_Port->BSRR;
+ DMA_init.DMA_MemoryBaseAddr = (U32)&wr_low;
+ DMA_init.DMA_MemoryInc = DMA_MemoryInc_Disable;
+ DMA_init.DMA_Mode = DMA_Mode_Normal;
+ DMA_Init(DMA1_Channel5, &DMA_init);
+ DMA_init.DMA_MemoryBaseAddr = (U32)&wr_high;
+ DMA_Init(DMA1_Channel7, &DMA_init);
+ DMA_ITConfig(DMA1_Channel7, DMA_IT_TC, ENABLE);
+
+ // Needed before the first clear, ahead of NVIC_Configuration()
+ NVIC_struct.NVIC_IRQChannel = DMA1_Channel7_IRQn;
+ NVIC_struct.NVIC_IRQChannelPreemptionPriority = 0;
+ NVIC_struct.NVIC_IRQChannelSubPriority = 0;
+ NVIC_struct.NVIC_IRQChannelCmd = ENABLE;
+ NVIC_Init(&NVIC_struct);
+}
+
+// Start the next run of at most TFT_DMA_CHUNK bytes
+static void dma_run(void)
+{
+ U16 n = (dma_left > TFT_DMA_CHUNK) ? TFT_DMA_CHUNK : dma_left;
+
+ dma_left -= n;
+
+ DMA_Cmd(DMA1_Channel4, DISABLE);
+ DMA_Cmd(DMA1_Channel5, DISABLE);
+ DMA_Cmd(DMA1_Channel7, DISABLE);
+
+ // A fill repeats one pixel, a blit moves the whole buffer
+ if(dma_data.DMA_Mode == DMA_Mode_Normal)
+	dma_data.DMA_BufferSize = n;
+ DMA_Init(DMA1_Channel4, &dma_data);
+ // No StdPeriph call for it in this library version, the channels are off
+ DMA1_Channel5->CNDTR = n;
+ DMA1_Channel7->CNDTR = n;
+ DMA_ClearITPendingBit(DMA1_IT_GL4 | DMA1_IT_GL5 | DMA1_IT_GL7);
+
+ DMA_Cmd(DMA1_Channel4, ENABLE);
+ DMA_Cmd(DMA1_Channel5, ENABLE);
+ DMA_Cmd(DMA1_Channel7, ENABLE);
+
+ TIM_SetCounter(TIM4, 0);
+ TIM_ClearFlag(TIM4, TIM_FLAG_Update | TIM_FLAG_CC2 | TIM_FLAG_CC3);
+ TIM_DMACmd(TIM4, TIM_DMA_CC2 | TIM_DMA_CC3 | TIM_DMA_Update, ENABLE);
+ TIM_Cmd(TIM4, ENABLE);
+}
+
+// Stream [bytes] bus bytes from dma_words, nCS low and a memory write started
+static void dma_stream(U32 bytes, U16 mode)
+{
+ dma_data.DMA_Mode = mode;
+ dma_data.DMA_BufferSize = 2;
+ dma_left = bytes;
+ dma_busy = 1;
+ dma_run();
+}
+
+// Channel 7 transfer complete, the last byte of the run is latched
+void TFT_DMA_Done(void)
+{
+ TIM_Cmd(TIM4, DISABLE);
+ // Drops any request left pending, a stale one would shift the strobes
+ TIM_DMACmd(TIM4, TIM_DMA_CC2 | TIM_DMA_CC3 | TIM_DMA_Update, DISABLE);
+
+ if(dma_left) {
+	dma_run();
+	return;
+	}
+
+ DMA_Cmd(DMA1_Channel4, DISABLE);
+ SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+ dma_busy = 0;
+}
+
+// Wait until the bus is free, sleeping until the channel 7 interrupt
+void TFT_DMA_Wait(void)
+{
+ __disable_irq();
+ while(dma_busy) {
+	__WFI();
+	__enable_irq();
+	__disable_irq();
+	}
+ __enable_irq();
+}
+
+// [n] pixels of [color], nCS must be low and a memory write started
+static void bus_fill(U16 color, U32 n)
+{
+ U32 hi = BUS_WORD(color >> 8);
+ U32 lo = BUS_WORD(color);
+
+ if(hi == lo) {
+	// Both bytes equal (black, white...): the bus holds, only strobe
+	TFT_Data_Base->BSRR = hi;
+	for(; n >= 4; n -= 4) {
+		BUS_STROBE(); BUS_STROBE(); BUS_STROBE(); BUS_STROBE();
+		BUS_STROBE(); BUS_STROBE(); BUS_STROBE(); BUS_STROBE();
+		}
+	for(; n; n--) {
+		BUS_STROBE(); BUS_STROBE();
+		}
+	return;
+	}
+
+ for(; n >= 4; n -= 4) {
+	BUS_PIXEL(hi, lo); BUS_PIXEL(hi, lo);
+	BUS_PIXEL(hi, lo); BUS_PIXEL(hi, lo);
+	}
+ for(; n; n--)
+	BUS_PIXEL(hi, lo);
+}
 
 #define	ASC8X16_Use_Display_Char_Only
 const U8 Font_ASC8X16[256*16] = {
@@ -298,6 +503,7 @@ FONT ASC8X16 = {
 void clr_screen(void)
 {
  	FillRect(ScreenX0, ScreenY0, ScreenXsize, ScreenYsize, BG_CL);
+ labels_invalidate();
 
 }
 void clr_blk(S16 x, S16 y, S16 sizex, S16 sizey)
@@ -311,117 +517,287 @@ void clr_square_blk(S16 x, S16 y, S16 size){
 
 void SetWindow(U16 x, U16 xsize, U16 y, U16 ysize)
 {
- write_comm(0x2A);
+ TFT_DMA_Wait();
+ vspan_x = 0xFFFF;
 
- write_data(x >> 8);
- write_data(x);
+ SetToLow(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+
+ bus_comm(0x2A);
+ BUS_BYTE(x >> 8);
+ BUS_BYTE(x);
  x = x + xsize - 1;
- write_data(x >> 8);
- write_data(x);
+ BUS_BYTE(x >> 8);
+ BUS_BYTE(x);
 
- 
- write_comm(0x2B);
- write_data(y >> 8);
- write_data(y);
+ bus_comm(0x2B);
+ BUS_BYTE(y >> 8);
+ BUS_BYTE(y);
  y = y + ysize - 1;
- write_data(y >> 8);
- write_data(y);
+ BUS_BYTE(y >> 8);
+ BUS_BYTE(y);
+
+ SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit));
 }
 
 
 
 // ==========================================
-// Fill rectangle area with given color
-void FillRect(S16 x, S16 y, S16 xsize, S16 ysize, U16 color)
+// Scroll the wave display columns left by [offset], see SCROLL_TFA
+void scroll_set(U16 offset)
+{
+ TFT_DMA_Wait();
+ scroll_ofs = offset;
+
+ write_comm(0x37);
+ write_data((SCROLL_TFA + offset) >> 8);
+ write_data((SCROLL_TFA + offset) & 0xFF);
+}
+
+// Frame memory column shown at screen column [x]
+static U16 scroll_x(U16 x)
 {
- U32 tmp; 
+ if(x < SCROLL_TFA || x >= SCROLL_TFA + SCROLL_VSA)
+	return x;
+
+ x += scroll_ofs;
+ return (x >= SCROLL_TFA + SCROLL_VSA) ? x - SCROLL_VSA : x;
+}
+
+// Number of columns from screen column [x] that are contiguous in frame memory
+static U16 scroll_run(U16 x, U16 xsize)
+{
+ U16 end;
+
+ if(!scroll_ofs || x >= SCROLL_TFA + SCROLL_VSA)
+	return xsize;
+
+ if(x < SCROLL_TFA)
+	end = SCROLL_TFA;
+ else if(x < SCROLL_TFA + SCROLL_VSA - scroll_ofs)
+	end = SCROLL_TFA + SCROLL_VSA - scroll_ofs;
+ else
+	end = SCROLL_TFA + SCROLL_VSA;
+
+ return (x + xsize > end) ? end - x : xsize;
+}
+
+// ==========================================
+// Fill one address window with given color, frame memory coordinates
+static void fill_window(S16 x, S16 y, S16 xsize, S16 ysize, U16 color)
+{
+ U32 n = (U32)xsize * (U32)ysize;
 
  SetWindow(x, xsize, y, ysize);
- 
-// Delay(200);
 
  SetToLow(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+ bus_comm(0x2C);
 
- SetToLow(TFT_RS_Port, (1 << TFT_RS_Bit));
-// Delay(2);
+ // Large fills go on in the background, nCS is released at the end
+ if(n >= TFT_DMA_MIN) {
+	dma_words[0] = BUS_WORD(color >> 8);
+	dma_words[1] = BUS_WORD(color);
+	dma_stream(2 * n, DMA_Mode_Circular);
+	return;
+	}
 
- TFT_Port = (TFT_Port & 0xFF00) | 0x2C;
- SetToLow(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- SetToHigh(TFT_nWR_Port, (1 << TFT_nWR_Bit));
+ bus_fill(color, n);
+ SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit)); 
+}
 
- tmp = (U32)xsize * (U32)ysize;
- // Set up to access Index Register (RS == 1)
- SetToHigh(TFT_RS_Port, (1 << TFT_RS_Bit));
+// Fill rectangle area with given color, split where the scroll area wraps
+void FillRect(S16 x, S16 y, S16 xsize, S16 ysize, U16 color)
+{
+ U16 n;
 
- while(tmp) {
-	TFT_Port = (TFT_Port & 0xFF00) | (color >> 8);
- 	SetToLow(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- 	SetToHigh(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- 	TFT_Port = (TFT_Port & 0xFF00) | color;
- 	SetToLow(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- 	SetToHigh(TFT_nWR_Port, (1 << TFT_nWR_Bit));
-	tmp--;
- 	}
+ while(xsize > 0) {
+	n = scroll_run(x, xsize);
+	fill_window(scroll_x(x), y, n, ysize, color);
+	x += n;
+	xsize -= n;
+	}
+}
 
- // Set TFT_nCS high
- SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit)); 
+// Draw glyph columns [col, col + cols) of [ch] at frame memory column [x]
+static void putc_window(U16 x, U16 y, U8 ch, U16 fgcolor, U16 bgcolor, FONT *font, U8 col, U8 cols)
+{
+ U8 tmp2, pitch;
+ U16 tmp1;
+ U32 fg_hi = BUS_WORD(fgcolor >> 8), fg_lo = BUS_WORD(fgcolor);
+ U32 bg_hi = BUS_WORD(bgcolor >> 8), bg_lo = BUS_WORD(bgcolor);
+ U32 *pw = dma_words;
+ U8 *ptmp;
+
+ // Font address
+ pitch = (font->Xsize + 7)/8;
+ ptmp = (U8 *)font->Array + (ch - font->IndexOfs) * pitch * font->Ysize;
+
+ // Also waits for the previous stream, dma_words is free after it
+ SetWindow(x, cols, y, font->Ysize);
+
+ SetToLow(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+ bus_comm(0x2C);
+
+ if(cols * font->Ysize > TFT_GLYPH_MAX) {
+	// Too big for the buffer, CPU it is
+	for(tmp1 = font->Ysize; tmp1; tmp1--, ptmp += pitch)
+		for(tmp2 = col; tmp2 < col + cols; tmp2++) {
+			if(ptmp[tmp2 >> 3] & (0x80 >> (tmp2 & 7)))
+				BUS_PIXEL(fg_hi, fg_lo);
+			else
+				BUS_PIXEL(bg_hi, bg_lo);
+			}
+	SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit)); 
+	return;
+	}
+
+ // Encode the glyph and blit it in the background
+ for(tmp1 = font->Ysize; tmp1; tmp1--, ptmp += pitch)
+	for(tmp2 = col; tmp2 < col + cols; tmp2++) {
+		if(ptmp[tmp2 >> 3] & (0x80 >> (tmp2 & 7))) {
+			*pw++ = fg_hi;
+			*pw++ = fg_lo;
+		} else {
+			*pw++ = bg_hi;
+			*pw++ = bg_lo;
+			}
+		}
+ dma_stream(pw - dma_words, DMA_Mode_Normal);
+}
+
+// ==========================================
+// Column spans: 1 pixel wide windows down one screen column. nCS stays low
+// from VSpanBegin() to VSpanEnd() and the column address is only sent when
+// the column changes, so the spans of one column cost a page address each.
+
+// Open rows [y, y + ysize) of screen column [x] for VSpanPut()
+void VSpanBegin(U16 x, U16 y, U16 ysize)
+{
+ TFT_DMA_Wait();
+ x = scroll_x(x);
+
+ SetToLow(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+
+ if(x != vspan_x) {
+	bus_comm(0x2A);
+	BUS_BYTE(x >> 8);
+	BUS_BYTE(x);
+	BUS_BYTE(x >> 8);
+	BUS_BYTE(x);
+	vspan_x = x;
+	}
+
+ bus_comm(0x2B);
+ BUS_BYTE(y >> 8);
+ BUS_BYTE(y);
+ y = y + ysize - 1;
+ BUS_BYTE(y >> 8);
+ BUS_BYTE(y);
+
+ bus_comm(0x2C);
+}
+
+// Next [n] pixels of the open span
+void VSpanPut(U16 color, U16 n)
+{
+ bus_fill(color, n);
+}
+
+void VSpanEnd(void)
+{
+ SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+}
+
+// Vertical run of [ysize] pixels of [color] down screen column [x]
+void VSpan(U16 x, U16 y, U16 ysize, U16 color)
+{
+ VSpanBegin(x, y, ysize);
+ VSpanPut(color, ysize);
+ VSpanEnd();
 }
 
 // Put at (x, y) a 15X16 character [ch] with [f_color] and [b_color]
 //
 void PutcGenic(U16 x, U16 y, U8 ch, U16 fgcolor, U16 bgcolor, FONT *font)
 {
- U8 tmp, tmp2;
- U16 tmp1, tmp3;
- U8 *ptmp;
+ U8 col = 0, n;
 
- // Font address
- ptmp = (U8 *)font->Array + (ch - font->IndexOfs) * ((font->Xsize + 7)/8) * font->Ysize;
+ // A character may straddle the scroll wrap, draw it in column runs
+ while(col < font->Xsize) {
+	n = scroll_run(x + col, font->Xsize - col);
+	putc_window(scroll_x(x + col), y, ch, fgcolor, bgcolor, font, col, n);
+	col += n;
+	}
+}
+
+// Draw [n] characters of [str] at frame memory column [x] in one address
+// window. Xsize must be 8: row [r] of the string is byte [r] of each glyph,
+// its bits are merged into fg/bg runs across glyphs and rows and each run
+// goes out with bus_fill(), so blank rows cost a strobe per byte.
+static void puts_window(U16 x, U16 y, U8 *str, U8 n, U16 fgcolor, U16 bgcolor, FONT *font)
+{
+ U8 row, i, bits, mask;
+ U16 color = bgcolor, cl;
+ U32 run = 0;
 
- SetWindow(x, font->Xsize, y, font->Ysize);
+ SetWindow(x, n * font->Xsize, y, font->Ysize);
 
  SetToLow(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+ bus_comm(0x2C);
 
- SetToLow(TFT_RS_Port, (1 << TFT_RS_Bit));
-// Delay(2);
-
- TFT_Port = (TFT_Port & 0xFF00) | 0x2C;
- SetToLow(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- SetToHigh(TFT_nWR_Port, (1 << TFT_nWR_Bit));
+ for(row = 0; row < font->Ysize; row++)
+	for(i = 0; i < n; i++) {
+		bits = font->Array[(str[i] - font->IndexOfs) * font->Ysize + row];
 
- SetToHigh(TFT_RS_Port, (1 << TFT_RS_Bit));
+		// Solid bytes extend or start a run in one go
+		if(bits == 0x00 || bits == 0xFF) {
+			cl = bits ? fgcolor : bgcolor;
+			if(cl != color) {
+				bus_fill(color, run);
+				color = cl;
+				run = 0;
+				}
+			run += 8;
+			continue;
+			}
 
- tmp1 = (font->Xsize * font->Ysize)/8;
- while(tmp1) {
- 	tmp = *ptmp;
-	tmp2 = 8;
-	while(tmp2) {
-		tmp3 = (tmp & 0x80) ? fgcolor : bgcolor;
-
- 		TFT_Port = (TFT_Port & 0xFF00) | (tmp3 >> 8);
- 		SetToLow(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- 		SetToHigh(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- 		TFT_Port = (TFT_Port & 0xFF00) | tmp3;
- 		SetToLow(TFT_nWR_Port, (1 << TFT_nWR_Bit));
- 		SetToHigh(TFT_nWR_Port, (1 << TFT_nWR_Bit));
-
-		tmp <<= 1;
-		tmp2--;
+		for(mask = 0x80; mask; mask >>= 1) {
+			cl = (bits & mask) ? fgcolor : bgcolor;
+			if(cl != color) {
+				bus_fill(color, run);
+				color = cl;
+				run = 0;
+				}
+			run++;
+			}
 		}
-	ptmp++;
-	tmp1--;	
- 	}
+ bus_fill(color, run);
 
  SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit)); 
 }
 
+// [n] characters of [str] at screen (x, y), one window unless the font is
+// not 8 wide or the string straddles the scroll wrap
+static void puts_run(U16 x, U16 y, U8 *str, U8 n, U16 fgcolor, U16 bgcolor, FONT *font)
+{
+ if(font->Xsize == 8 && font->CharPitch == 8 && scroll_run(x, n * 8) == n * 8) {
+	puts_window(scroll_x(x), y, str, n, fgcolor, bgcolor, font);
+	return;
+	}
+
+ for(; n; n--, str++, x += font->CharPitch)
+	PutcGenic(x, y, *str, fgcolor, bgcolor, font);
+}
+
 void PutsGenic(U16 x, U16 y, U8 *str, U16 fgcolor, U16 bgcolor, FONT *font)
 {
- U8 tmp;
+ U8 n;
  
- while((tmp = *str++)) {
-	PutcGenic(x, y, tmp, fgcolor, bgcolor, font);
-	x += font->CharPitch;
+ while(*str) {
+	// The characters that start on this line
+	for(n = 1; str[n] && x + n * font->CharPitch < ScreenXsize; n++);
+	puts_run(x, y, str, n, fgcolor, bgcolor, font);
+	str += n;
+	x += n * font->CharPitch;
 	if(x >= ScreenXsize) {
 		y += font->LinePitch;
 		x = 0;
@@ -429,6 +805,53 @@ void PutsGenic(U16 x, U16 y, U8 *str, U16 fgcolor, U16 bgcolor, FONT *font)
  	}
 }
 
+/* Draw info bar label [id] with [str] at (x, y). Only the characters that
+ * differ from the text drawn last time are sent, a shorter text clears the
+ * rest of the old one. */
+void label_puts(U8 id, U16 x, U16 y, U8 *str, U16 fgcolor, U16 bgcolor)
+{
+	struct label *l;
+	U8 i = 0, start, n, old, shown;
+
+	l = &labels[id];
+	n = strlen((char *)str);
+	if(n > LABEL_LEN)
+		n = LABEL_LEN;
+	old = shown = strlen((char *)l->text);
+
+	/* New colours repaint every character */
+	if(l->fg != fgcolor || l->bg != bgcolor)
+		old = 0;
+
+	while(i < n) {
+		if(i < old && str[i] == l->text[i]) {
+			++i;
+			continue;
+		}
+		/* Changed characters next to each other share one window */
+		start = i;
+		while(i < n && (i >= old || str[i] != l->text[i]))
+			++i;
+		puts_run(x + start * CHAR_WID, y, str + start, i - start, fgcolor, bgcolor, &ASC8X16);
+	}
+	if(shown > n)
+		FillRect(x + n * CHAR_WID, y, (shown - n) * CHAR_WID, ASC8X16.Ysize, l->bg);
+
+	memcpy(l->text, str, n);
+	l->text[n] = '\0';
+	l->fg = fgcolor;
+	l->bg = bgcolor;
+}
+
+/* Forget what the labels show, the next label_puts() draws them in full */
+void labels_invalidate(void)
+{
+	U8 i;
+
+	for(i = 0; i < LABELS_NR; ++i)
+		labels[i].text[0] = '\0';
+}
+
 /* Display functions */
 void grid_display(void)
 {
@@ -464,8 +887,10 @@ void grid_display(void)
 /* Display coursor */
 void cursor_display(U16 posx, U16 posy, U8 cursor_type, U16 cursor_cl)
 {
-	clr_blk(posx, posy - 10, 8, 16 + 20);
+	/* Clear above and below the glyph, never under it */
+	clr_blk(posx, posy - 10, 8, 10);
 	PutcGenic(posx, posy, cursor_type, cursor_cl, BG_CL, &ASC8X16);
+	clr_blk(posx, posy + 16, 8, 10);
 }
 
 /* Display timebase */
@@ -477,81 +902,182 @@ void timebase_display(U16 flag)
 	U16 cl = (dso_scope.btn_selected == tb) ? SELECTED_CL : clGreen;
 	BitClr(dso_scope.btns_flags, (1 << TB_BIT));
 
-	clr_blk(TIMEBASE_OFFSETX, TIMEBASE_OFFSETY, 5 * 8, 12);
-	if(dso_scope.timebase >= 1000){
-		PutsGenic(TIMEBASE_OFFSETX + 8, TIMEBASE_OFFSETY, (U8 *)" ms", cl, clBlack, &ASC8X16);
-		PutsGenic(TIMEBASE_OFFSETX, TIMEBASE_OFFSETY, (U8 *)itoa(dso_scope.timebase / 1000, buf, 10), cl, clBlack, &ASC8X16);
+	if(dso_scope.timebase >= 1000000) {
+		itoa(dso_scope.timebase / 1000000, buf, 10);
+		strcat((char *)buf, "s");
+	} else if(dso_scope.timebase >= 1000) {
+		itoa(dso_scope.timebase / 1000, buf, 10);
+		strcat((char *)buf, "ms");
 	} else {
-		PutsGenic(TIMEBASE_OFFSETX + 17, TIMEBASE_OFFSETY, (U8 *)" us", cl, clBlack, &ASC8X16);
-		PutsGenic(TIMEBASE_OFFSETX, TIMEBASE_OFFSETY, (U8 *)itoa(dso_scope.timebase, buf, 10), cl, clBlack, &ASC8X16);	
+		itoa(dso_scope.timebase, buf, 10);
+		strcat((char *)buf, "us");
 	}
+	label_puts(LBL_TB, TIMEBASE_OFFSETX, TIMEBASE_OFFSETY, buf, cl, clBlack);
 
 	BitClr(dso_scope.btns_flags, (1 << PLUS_BTN_BIT));
 	BitClr(dso_scope.btns_flags, (1 << MINUS_BTN_BIT));
 	
 }
 
-/* Display any voltage */
-void voltage_display(U16 posx, U16 posy, U8 *label, U16 adc_val, U16 text_clr, U16 bg_clr)
+/* Display trigger position */
+void trig_pos_display(U16 flag)
 {
-	U16 voltage = ( adc_val * 0.8);
-	U16 label_s = strlen(label);
-	U8 *ptr = buf;
+	if(!flag)
+		return;
 
-	U8 v_buf[6] = {'0', '.', '0', '0', 'V', '\0'};
+	U16 cl = (dso_scope.btn_selected == tp) ? SELECTED_CL : clGreen;
+	BitClr(dso_scope.btns_flags, (1 << TP_BIT));
+
+	strcpy((char *)buf, "T:");
+	itoa(trig_pos_vals[dso_scope.tp_i], buf + 2, 10);
+	strcat((char *)buf, "%");
+	label_puts(LBL_TP, TRIGPOS_OFFSETX, TRIGPOS_OFFSETY, buf, cl, clBlack);
+}
+
+/* Display averaging setting: "A:off", "B:N" (boxcar) or "E:N" (exponential) */
+void avg_display(U16 flag)
+{
+	if(!flag)
+		return;
+
+	U16 cl = (dso_scope.btn_selected == av) ? SELECTED_CL : clGreen;
+	BitClr(dso_scope.btns_flags, (1 << AVG_BIT));
+
+	switch(AVG_TYPE(dso_scope.avg_i)) {
+	case AVG_OFF:
+		label_puts(LBL_AVG, AVG_OFFSETX, AVG_OFFSETY, (U8 *)"A:off", cl, clBlack);
+		return;
+	case AVG_BOXCAR:
+		strcpy((char *)buf, "B:");
+		break;
+	case AVG_EXPONENTIAL:
+		strcpy((char *)buf, "E:");
+		break;
+	}
+	itoa(1 << AVG_SHIFT(dso_scope.avg_i), buf + 2, 10);
+	label_puts(LBL_AVG, AVG_OFFSETX, AVG_OFFSETY, buf, cl, clBlack);
+}
+
+/* Display the slow timebase acquisition mode */
+void acq_display(U16 flag)
+{
+	if(!flag)
+		return;
+
+	U16 cl = dso_scope.acq_i ? ACQ_ACT_CL : ACQ_DEAC_CL;
+	if(dso_scope.btn_selected == aq)
+		cl = SELECTED_CL;
+	BitClr(dso_scope.btns_flags, (1 << ACQ_BIT));
+
+	switch(acq_sel_modes[dso_scope.acq_i]) {
+	case ACQ_PEAK:
+		label_puts(LBL_ACQ, ACQ_OFFSETX, ACQ_OFFSETY, (U8 *)"PEAK", cl, clBlack);
+		break;
+	case ACQ_HIRES:
+		label_puts(LBL_ACQ, ACQ_OFFSETX, ACQ_OFFSETY, (U8 *)"HRES", cl, clBlack);
+		break;
+	default:
+		label_puts(LBL_ACQ, ACQ_OFFSETX, ACQ_OFFSETY, (U8 *)"NORM", cl, clBlack);
+		break;
+	}
+}
 
-	if(voltage > 0) {
-		itoa(voltage / 1000, buf, 10);
-		v_buf[0] = buf[0];
+/* Display mode over the wave display, the plain trace only while selected */
+void disp_display(U16 flag)
+{
+	if(!flag)
+		return;
 
-		if(voltage > 1000)
-			voltage %= 1000;
-		voltage /= 10;
+	U16 cl = (dso_scope.btn_selected == dm) ? SELECTED_CL : clGreen;
+	BitClr(dso_scope.btns_flags, (1 << DISP_BIT));
 
-		/* Fractional part */
-		itoa(voltage, buf, 10);
-		ASSIGN_POS(v_buf[2], buf[0], ptr++);
-		ASSIGN_POS(v_buf[3], buf[1], ptr);
+	switch(dso_scope.disp_i) {
+	case DISP_PERSIST:
+		render_text(RENDER_TEXT_MODE, DISP_OFFSETX, DISP_OFFSETY, (U8 *)"PERS", cl, BG_CL);
+		break;
+	case DISP_FFT + FFT_HANN:
+		render_text(RENDER_TEXT_MODE, DISP_OFFSETX, DISP_OFFSETY, (U8 *)"F:han", cl, BG_CL);
+		break;
+	case DISP_FFT + FFT_FLATTOP:
+		render_text(RENDER_TEXT_MODE, DISP_OFFSETX, DISP_OFFSETY, (U8 *)"F:flt", cl, BG_CL);
+		break;
+	default:
+		render_text(RENDER_TEXT_MODE, DISP_OFFSETX, DISP_OFFSETY,
+			(dso_scope.btn_selected == dm) ? (U8 *)"WAVE" : NULL, cl, BG_CL);
+		break;
 	}
+}
+
+/* [label] followed by the voltage of [adc_val] into [text] */
+void voltage_str(U8 *text, U8 *label, U16 adc_val)
+{
+	U16 cv = ADC_MV(adc_val) / 10;	/* Centivolts */
+	U8 v_buf[6] = {'0', '.', '0', '0', 'V', '\0'};
+
+	v_buf[0] = '0' + cv / 100;
+	v_buf[2] = '0' + (cv / 10) % 10;
+	v_buf[3] = '0' + cv % 10;
+
+	strcpy((char *)text, (char *)label);
+	strcat((char *)text, (char *)v_buf);
+}
+
+/* Display any voltage */
+void voltage_display(U8 id, U16 posx, U16 posy, U8 *label, U16 adc_val, U16 text_clr, U16 bg_clr)
+{
+	U8 text[LABEL_LEN + 1];
 
-	/* Display */
-	PutsGenic(posx, posy, label, text_clr, bg_clr, &ASC8X16);
-	PutsGenic(posx + label_s * CHAR_WID, posy, v_buf, text_clr, bg_clr, &ASC8X16);
+	voltage_str(text, label, adc_val);
+	label_puts(id, posx, posy, text, text_clr, bg_clr);
 }
 
-/* Display the previously calculated frequency */
+/* Display the frequency counter result, four significant digits */
 void freq_display(double freq)
 {
-	clr_blk(FREQ_OFFSETX, FREQ_OFFSETY, FREQ_SIZE, 16);
-	PutsGenic(FREQ_OFFSETX, FREQ_OFFSETY, (U8 *)"Freq:", TEXT_CL, BG_CL, &ASC8X16);
+	static const U16 pow10[] = { 1, 10, 100, 1000 };
+	U8 *unit = (U8 *)"Hz";
+	U8 dec, frac[6], text[LABEL_LEN + 1] = "Freq:";
+	U32 val;
+
 	if(!freq){
-		PutcGenic(FREQ_OFFSETX + 5 * CHAR_WID, FREQ_OFFSETY, '-', TEXT_CL, BG_CL, &ASC8X16);	
+		label_puts(LBL_FREQ, FREQ_OFFSETX, FREQ_OFFSETY, (U8 *)"Freq:-", TEXT_CL, BG_CL);
 		return;
 	}
-	U32 frq_int = freq * 100; /* Precision of two */
-
-	U8 dig_buf[7];
-	get_digits(frq_int, dig_buf);
-	S8 dig_ind = strlen(dig_buf);
 
-	U8 f_buf[9] = { '0', '0', '.', '0', '0', 'K', 'H', 'z', '\0'};
+	if(freq >= 1000000) {
+		freq /= 1000000;
+		unit = (U8 *)"MHz";
+	} else if(freq >= 1000) {
+		freq /= 1000;
+		unit = (U8 *)"kHz";
+	}
+	dec = (freq >= 100) ? 1 : (freq >= 10) ? 2 : 3;
+	val = freq * pow10[dec] + 0.5;
 
-	U8 *ptr = f_buf;
-	ASSIGN_POS(f_buf[4], dig_buf[0], dig_ind);
-	ASSIGN_POS(f_buf[3], dig_buf[1], --dig_ind);
-	ASSIGN_POS(f_buf[1], dig_buf[2], --dig_ind);
-	ASSIGN_POS(f_buf[0], dig_buf[3], --dig_ind);
+	/* Integer part, then the fraction with its leading zeros */
+	itoa(val / pow10[dec], buf, 10);
+	strcat((char *)buf, ".");
+	itoa(val % pow10[dec] + pow10[dec], frac, 10);
+	strcat((char *)buf, (char *)frac + 1);
+	strcat((char *)buf, (char *)unit);
+	strcat((char *)text, (char *)buf);
 
-	PutsGenic(FREQ_OFFSETX + 5 * CHAR_WID, FREQ_OFFSETY, ptr, TEXT_CL, BG_CL, &ASC8X16);
+	label_puts(LBL_FREQ, FREQ_OFFSETX, FREQ_OFFSETY, text, TEXT_CL, BG_CL);
 }
 
 void info_display(void)
 {
+	double freq;
+
 	timebase_display(BitTest(dso_scope.btns_flags, (1 << TB_BIT)));
+	trig_pos_display(BitTest(dso_scope.btns_flags, (1 << TP_BIT)));
+	avg_display(BitTest(dso_scope.btns_flags, (1 << AVG_BIT)));
+	acq_display(BitTest(dso_scope.btns_flags, (1 << ACQ_BIT)));
+	disp_display(BitTest(dso_scope.btns_flags, (1 << DISP_BIT)));
 	/* Update peak-to-peak voltage */
-	voltage_display(PPV_OFFSETX, PPV_OFFSETY, (U8 *)"Vpp:", (wave.max - wave.min + NOISE_MARGIN), TEXT_CL, BG_CL);
+	voltage_display(LBL_VPP, PPV_OFFSETX, PPV_OFFSETY, (U8 *)"Vpp:", (wave.max - wave.min + NOISE_MARGIN), TEXT_CL, BG_CL);
 	/* Update max voltage */
-	voltage_display(MAXV_OFFSETX, MAXV_OFFSETY, (U8 *)"Vmax:", (wave.max + NOISE_MARGIN), TEXT_CL, BG_CL);
+	voltage_display(LBL_VMAX, MAXV_OFFSETX, MAXV_OFFSETY, (U8 *)"Vmax:", (wave.max + NOISE_MARGIN), TEXT_CL, BG_CL);
 
 	/* Display cursors */
 	if(BitClrIfSet(dso_scope.btns_flags, (1 << LCURSOR_BIT)) || 
@@ -560,13 +1086,51 @@ void info_display(void)
 			(dso_scope.btn_selected == l_cursor) ? SELECTED_CL : CURSOR_LEFT_CL);
 
 		cursor_display(CURSOR_RIGHTX, wave.midpoint - GET_SAMPLE(dso_scope.trig_lvl_adc) - 6, '<', 
-			(dso_scope.btn_selected == r_cursor) ? SELECTED_CL : CURSOR_RIGHT_CL);
+			(dso_scope.btn_selected == r_cursor) ? SELECTED_CL :
+			dso_scope.trig_auto ? TRIG_AUTO_CL : CURSOR_RIGHT_CL);
 	}
 
 	/* Display frequency */
 	if(!(--freq_delay)) {
-		freq_display(wave.frequency);
+		/* The spectrum shows its strongest line, otherwise the trace
+		 * period stands in while TrigIn sees no edges */
+		freq = fft.on ? fft_peak_mhz() / 1000.0 : freqcnt_freq();
+		if(!freq && !dso_scope.rolling)
+			freq = meas_freq_mhz() / 1000.0;
+		freq_display(freq);
 		freq_delay = FREQ_DELAY;
 	}
+
+	stats_display();
+}
+
+/* Frames per second and idle percentage of the last second */
+void stats_display(void)
+{
+	itoa(loop.fps, buf, 10);
+	strcat((char *)buf, "fps");
+	label_puts(LBL_FPS, FPS_OFFSETX, FPS_OFFSETY, buf, STATS_CL, clBlack);
+
+	/* Never 100 with frames drawn, keeps the label inside the screen */
+	strcpy((char *)buf, "I:");
+	itoa((loop.idle > 99) ? 99 : loop.idle, buf + 2, 10);
+	strcat((char *)buf, "%");
+	label_puts(LBL_IDLE, IDLE_OFFSETX, IDLE_OFFSETY, buf, STATS_CL, clBlack);
 }
 
+/* Redraw every label, e.g. after the screen was scrolled under them */
+void info_redraw(void)
+{
+	BitSet(dso_scope.btns_flags, (1 << LCURSOR_BIT));
+	BitSet(dso_scope.btns_flags, (1 << RCURSOR_BIT));
+	BitSet(dso_scope.btns_flags, (1 << TB_BIT));
+	BitSet(dso_scope.btns_flags, (1 << TP_BIT));
+	BitSet(dso_scope.btns_flags, (1 << AVG_BIT));
+	BitSet(dso_scope.btns_flags, (1 << ACQ_BIT));
+	BitSet(dso_scope.btns_flags, (1 << DISP_BIT));
+	labels_invalidate();
+
+	label_puts(LBL_SINGLE, SINGLES_OFFSETX, SINGLES_OFFSETY, (U8 *)"SINGLE",
+		BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT)) ? SINGLES_ACT_CL : SINGLES_DEAC_CL, clBlack);
+	freq_display(freqcnt_freq());
+}
@@ -76,6 +76,20 @@ typedef struct {
 #define WD_MIDY				(WD_OFFSETY + (WD_HEIGHT / 2))
 #define BLK_PX				25		/* Pixels per block */
 
+/* Hardware scroll area for roll mode. With MADCTL MV set the ILI9341
+ * vertical scroll moves panel lines, i.e. screen columns. */
+#define SCROLL_TFA			WD_OFFSETX
+#define SCROLL_VSA			WD_WIDTH
+#define SCROLL_BFA			(ScreenXsize - WD_OFFSETX - WD_WIDTH)
+
+/* DMA pixel streaming, TIM4 paces one bus byte per TFT_DMA_CLKS */
+#define TFT_DMA_CLKS			24
+#define TFT_DMA_DATA_AT			2		/* CC2: data word to GPIOB, hold after nWR high */
+#define TFT_DMA_WR_AT			(TFT_DMA_CLKS / 2)	/* CC3: nWR low, update: nWR high */
+#define TFT_DMA_MIN			64		/* Smaller fills are quicker from the CPU */
+#define TFT_DMA_CHUNK			65534		/* Bus bytes per DMA run, even */
+#define TFT_GLYPH_MAX			(8 * 16)	/* Pixels of the largest glyph */
+
 /* Grid */
 #define GRID_WIDTH			1
 #define GRID_CENTER_WIDTH		1	
@@ -92,6 +106,24 @@ typedef struct {
 #define TIMEBASE_OFFSETX		142
 #define TIMEBASE_OFFSETY		ScreenYsize - WD_OFFSETY + 4
 
+/* Trigger position */
+#define TRIGPOS_OFFSETX			100
+#define TRIGPOS_OFFSETY			ScreenYsize - WD_OFFSETY + 4
+
+/* Averaging */
+#define AVG_OFFSETX			190
+#define AVG_OFFSETY			ScreenYsize - WD_OFFSETY + 4
+
+/* Slow timebase acquisition mode */
+#define ACQ_OFFSETX			238
+#define ACQ_OFFSETY			ScreenYsize - WD_OFFSETY + 4
+#define ACQ_DEAC_CL			clWhite
+#define ACQ_ACT_CL			clGreen
+
+/* Display mode, composed into the top left of the wave display */
+#define DISP_OFFSETX			(WD_OFFSETX + 2)
+#define DISP_OFFSETY			(WD_OFFSETY + 2)
+
 /* Peak-to-peak voltage */
 #define PPV_SIZE			9 * CHAR_WID
 #define PPV_OFFSETX			WD_OFFSETX + 5
@@ -117,6 +149,7 @@ typedef struct {
 #define CURSOR_LEFTX			0
 #define CURSOR_RIGHT_CL			clAqua
 #define CURSOR_RIGHTX			WD_OFFSETX + WD_WIDTH
+#define TRIG_AUTO_CL			clOrange	/* Right cursor, trigger timed out */
 
 /* SINGLE mode */
 #define SINGLES_OFFSETX			50
@@ -126,27 +159,68 @@ typedef struct {
 
 #define SELECTED_CL			clHotpink
 
-/* Time voltage cursor */	
+/* Frame rate and idle time, see loop.h */
+#define FPS_OFFSETX			2
+#define FPS_OFFSETY			ScreenYsize - WD_OFFSETY + 4
+#define IDLE_OFFSETX			274
+#define IDLE_OFFSETY			ScreenYsize - WD_OFFSETY + 4
+#define STATS_CL			clGray2
+
+/* Time voltage cursor, the labels are composed into the wave display */	
 #define TVC_CL				clYellow
-#define TVC_LABEL_OFFSETX		200
-#define	TVC_LABEL_OFFSETY		ScreenYsize - 45
+#define TVC_LABEL_OFFSETX		(WD_OFFSETX + WD_WIDTH - 15 * CHAR_WID)
+#define	TVC_LABEL_OFFSETY		(WD_OFFSETY + WD_HEIGHT - 18 - 16)
+
+/* Info bar labels cached by label_puts() */
+#define LABEL_LEN			16
+enum label_id {
+	LBL_VPP,
+	LBL_VMAX,
+	LBL_FREQ,
+	LBL_TB,
+	LBL_TP,
+	LBL_AVG,
+	LBL_ACQ,
+	LBL_SINGLE,
+	LBL_FPS,
+	LBL_IDLE,
+	LABELS_NR
+};
 
 extern	FONT ASC8X16;
 
 void	clr_screen(void);
 void	clr_blk(S16 x, S16 y, S16 sizex, S16 sizey);
 void 	clr_square_blk(S16 x, S16 y, S16 size);
+void	TFT_DMA_Init(void);
+void	TFT_DMA_Wait(void);
+void	TFT_DMA_Done(void);
 void	SetWindow(U16 x, U16 xsize, U16 y, U16 ysize);
 void 	FillRect(S16 x, S16 y, S16 xsize, S16 ysize, U16 color);
+void	VSpanBegin(U16 x, U16 y, U16 ysize);
+void	VSpanPut(U16 color, U16 n);
+void	VSpanEnd(void);
+void	VSpan(U16 x, U16 y, U16 ysize, U16 color);
 void	PutcGenic(U16 x, U16 y, U8 ch, U16 fgcolor, U16 bgcolor, FONT *font);
 void	PutsGenic(U16 x, U16 y, U8 *str, U16 fgcolor, U16 bgcolor, FONT *font);
+void	label_puts(U8 id, U16 x, U16 y, U8 *str, U16 fgcolor, U16 bgcolor);
+void	labels_invalidate(void);
+
+void	scroll_set(U16 offset);
 
 void 	info_display(void);
+void 	info_redraw(void);
 void 	grid_display(void);
 void 	timebase_display(U16 timebase);
+void 	trig_pos_display(U16 flag);
+void 	avg_display(U16 flag);
+void 	acq_display(U16 flag);
+void 	disp_display(U16 flag);
 void 	cursor_display(U16 posx, U16 posy, U8 cursor_type, U16 cursor_cl);
-void 	voltage_display(U16 posx, U16 posy, U8 *label, U16 adc_val, U16 text_clr, U16 bg_clr);
+void 	voltage_str(U8 *text, U8 *label, U16 adc_val);
+void 	voltage_display(U8 id, U16 posx, U16 posy, U8 *label, U16 adc_val, U16 text_clr, U16 bg_clr);
 void 	freq_display(double freq);
+void 	stats_display(void);
 
 #endif
 
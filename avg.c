@@ -0,0 +1,75 @@
+#include "stm32f10x.h"
+
+#include "avg.h"
+#include "scope.h"
+#include "Common.h"
+
+struct averager avg;
+
+const U8 avg_shifts[AVG_SHIFTS_NR] = {1, 2, 3, 4, 6, 8};
+
+/* Select one of the AVG_MODES_NR settings, the old average is dropped */
+void avg_config(U8 mode_i)
+{
+	avg.type = AVG_TYPE(mode_i);
+	avg.shift = (avg.type == AVG_BOXCAR || avg.type == AVG_EXPONENTIAL) ? AVG_SHIFT(mode_i) : 0;
+	avg_reset();
+}
+
+/* Start over, e.g. after the timebase or trigger position changed */
+void avg_reset(void)
+{
+	avg.count = 0;
+	avg.full = 0;
+}
+
+/*
+ * Fold a new frame into the accumulators and replace it with the average.
+ * Hi-res frames reach 65520, 65520 * 256 < 2^24, so neither mode can
+ * overflow.
+ */
+void avg_frame(__IO U16 *buf)
+{
+	U16 i;
+	U32 n, half;
+
+	switch(avg.type) {
+	case AVG_BOXCAR:
+		n = ++avg.count;
+		half = n >> 1;
+		for(i = 0; i < SAMPLES_NR; ++i) {
+			if(n == 1)
+				avg.acc[i] = buf[i];
+			else
+				avg.acc[i] += buf[i];
+
+			/* Block complete, its mean stays up while the next one fills */
+			if(n == (1UL << avg.shift))
+				avg.mean[i] = (avg.acc[i] + half) >> avg.shift;
+			buf[i] = avg.full ? avg.mean[i] : (avg.acc[i] + half) / n;
+		}
+
+		if(n == (1UL << avg.shift)) {
+			avg.count = 0;
+			avg.full = 1;
+		}
+		break;
+	case AVG_EXPONENTIAL:
+		/* Seed with the first frame so the trace doesn't ramp up from 0 */
+		if(!avg.count) {
+			for(i = 0; i < SAMPLES_NR; ++i)
+				avg.acc[i] = (U32)buf[i] << avg.shift;
+			avg.count = 1;
+			break;
+		}
+
+		half = 1 << (avg.shift - 1);
+		for(i = 0; i < SAMPLES_NR; ++i) {
+			avg.acc[i] = avg.acc[i] - (avg.acc[i] >> avg.shift) + buf[i];
+			buf[i] = (avg.acc[i] + half) >> avg.shift;
+		}
+		break;
+	default:
+		break;
+	}
+}
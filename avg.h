@@ -0,0 +1,44 @@
+#ifndef AVG_H
+#define AVG_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+#include "scope.h"
+
+/*
+ * N-frame waveform averaging, run from the main loop on the front buffer.
+ *
+ * Samples are folded into 32-bit accumulators, N is always a power of two:
+ *	AVG_BOXCAR      - plain sum of N frames. The mean of the last complete
+ *	                  block is shown while the next one fills, the running
+ *	                  mean only until the first block is complete
+ *	AVG_EXPONENTIAL - acc += val - acc / N, acc holds the mean scaled by N
+ */
+#define AVG_OFF			0
+#define AVG_BOXCAR		1
+#define AVG_EXPONENTIAL		2
+
+/* Selectable settings: off, boxcar and exponential for each N */
+#define AVG_SHIFTS_NR		6				/* N = 2, 4, 8, 16, 64, 256 */
+#define AVG_MODES_NR		(1 + 2 * AVG_SHIFTS_NR)
+#define AVG_TYPE(i)		(!(i) ? AVG_OFF : \
+					((i) <= AVG_SHIFTS_NR ? AVG_BOXCAR : AVG_EXPONENTIAL))
+#define AVG_SHIFT(i)		(avg_shifts[((i) - 1) % AVG_SHIFTS_NR])
+
+struct averager {
+	U32 acc[SAMPLES_NR];
+	U16 mean[SAMPLES_NR];	/* Boxcar, last complete block */
+	U16 count;		/* Frames in the accumulators */
+	U8 full;		/* Boxcar, mean is valid */
+	U8 type;
+	U8 shift;		/* log2(N) */
+};
+
+extern const U8 avg_shifts[AVG_SHIFTS_NR];
+
+void avg_config(U8 mode_i);
+void avg_reset(void);
+void avg_frame(__IO U16 *buf);
+
+#endif
@@ -0,0 +1,236 @@
+#include "stm32f10x.h"
+
+#include "bench.h"
+#include "sched.h"
+#include "render.h"
+#include "measure.h"
+#include "avg.h"
+#include "peak.h"
+#include "scope.h"
+#include "Screen.h"
+#include "Board.h"
+#include "Common.h"
+
+#ifdef BENCH
+
+extern struct waveform wave;
+extern struct scope dso_scope;
+extern struct peak peak;
+
+struct bench {
+	const char *name;
+	void (*run)(void);
+	void (*setup)(void);	/* Once before the runs, may be 0 */
+};
+
+/* The bus as it was written before the BSRR words: ODR read-modify-write */
+#define RMW_BYTE(b)	do { TFT_Port = (TFT_Port & 0xFF00) | (U8)(b); \
+			SetToLow(TFT_nWR_Port, (1 << TFT_nWR_Bit)); \
+			SetToHigh(TFT_nWR_Port, (1 << TFT_nWR_Bit)); } while(0)
+
+static void rmw_fill(U16 color, U32 n)
+{
+	while(n--) {
+		RMW_BYTE(color >> 8);
+		RMW_BYTE(color);
+	}
+}
+
+static void span_rmw(void)
+{
+	VSpanBegin(WD_OFFSETX, WD_OFFSETY, WD_HEIGHT);
+	rmw_fill(WF_CL, WD_HEIGHT);
+	VSpanEnd();
+}
+
+static void span_bsrr(void)
+{
+	VSpan(WD_OFFSETX, WD_OFFSETY, WD_HEIGHT, WF_CL);
+}
+
+static void fill_rmw(void)
+{
+	SetWindow(WD_OFFSETX, BENCH_FILL, WD_OFFSETY, BENCH_FILL);
+	SetToLow(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+	SetToLow(TFT_RS_Port, (1 << TFT_RS_Bit));
+	RMW_BYTE(0x2C);
+	SetToHigh(TFT_RS_Port, (1 << TFT_RS_Bit));
+	rmw_fill(WF_CL, BENCH_FILL * BENCH_FILL);
+	SetToHigh(TFT_nCS_Port, (1 << TFT_nCS_Bit));
+}
+
+/* DMA runs in the background, the wait is the bus time */
+static void fill_dma(void)
+{
+	FillRect(WD_OFFSETX, WD_OFFSETY, BENCH_FILL, BENCH_FILL, WF_CL);
+	TFT_DMA_Wait();
+}
+
+static void text(void)
+{
+	PutsGenic(WD_OFFSETX, WD_OFFSETY, (U8 *)"0123456789", WF_CL, BG_CL, &ASC8X16);
+	TFT_DMA_Wait();
+}
+
+static void render_full(void)
+{
+	render_invalidate();
+	render_frame();
+}
+
+/* Same frame again, the column diff sends nothing */
+static void render_same(void)
+{
+	render_frame();
+}
+
+/* Drifts one sample per run */
+static void render_move(void)
+{
+	U16 i, v;
+
+	v = wave.display_buf[0];
+	for(i = 1; i < SAMPLES_NR; ++i)
+		wave.display_buf[i - 1] = wave.display_buf[i];
+	wave.display_buf[SAMPLES_NR - 1] = v;
+	render_frame();
+}
+
+/* The first run sets the thresholds, the best run has edges */
+static void measure(void)
+{
+	meas_frame();
+}
+
+/* Largest N, on the back buffer so the bench frame stays */
+static void avg_boxcar_setup(void)
+{
+	avg_config(AVG_SHIFTS_NR);
+}
+
+static void avg_exp_setup(void)
+{
+	avg_config(2 * AVG_SHIFTS_NR);
+	avg_frame(wave.frames[1]);
+}
+
+static void avg_run(void)
+{
+	avg_frame(wave.frames[1]);
+}
+
+/*
+ * One pass of the sub_buf ring at PEAK_DECIM_MAX, both halves. It has to
+ * take well under the 2 * PEAK_CLKS * decim cycles the ADC needs to fill
+ * them, printed as peak_budget.
+ */
+static void peak_setup(void)
+{
+	U16 i;
+
+	wave.ring_len = SAMPLES_NR;
+	peak_start(PEAK_DECIM_MAX);
+	for(i = 0; i < 2 * PEAK_DECIM_MAX; ++i)
+		peak.sub_buf[i] = wave.frames[0][i];
+}
+
+static void peak_max_setup(void)
+{
+	dso_scope.acq_mode = ACQ_PEAK;
+	peak_setup();
+}
+
+static void peak_hires_setup(void)
+{
+	dso_scope.acq_mode = ACQ_HIRES;
+	peak_setup();
+}
+
+static void peak_run(void)
+{
+	peak_reduce();
+	peak_reduce();
+}
+
+static const struct bench benches[] = {
+	{ "span_rmw", span_rmw },
+	{ "span_bsrr", span_bsrr },
+	{ "fill_rmw", fill_rmw },
+	{ "fill_dma", fill_dma },
+	{ "text", text },
+	{ "render_full", render_full },
+	{ "render_same", render_same },
+	{ "render_move", render_move },
+	{ "measure", measure },
+	{ "avg_boxcar", avg_run, avg_boxcar_setup },
+	{ "avg_exp", avg_run, avg_exp_setup },
+	{ "peak_max", peak_run, peak_max_setup },
+	{ "peak_hires", peak_run, peak_hires_setup },
+};
+
+/* Triangle wave over half the screen height, 3 periods per frame */
+static void bench_frame(void)
+{
+	U16 i, p;
+
+	for(i = 0; i < SAMPLES_NR; ++i) {
+		p = i % (SAMPLES_NR / 3);
+		if(p >= SAMPLES_NR / 6)
+			p = SAMPLES_NR / 3 - p;
+		wave.frames[0][i] = ADC_MAX / 4 + (U32)p * (ADC_MAX / 2) / (SAMPLES_NR / 6);
+	}
+	wave.display_buf = wave.frames[0];
+	wave.display_min = wave.frames_min[0];
+	wave.display_peak = 0;
+	wave.display_shift = 0;
+	wave.midpoint = WD_MIDY;
+}
+
+static void bench_print(const char *name, U32 cycles)
+{
+	U8 s[11], *p = s + sizeof(s) - 1;
+
+	*p = 0;
+	do {
+		*--p = '0' + cycles % 10;
+		cycles /= 10;
+	} while(cycles);
+
+	uputs((U8 *)"bench ", USART1);
+	uputs((U8 *)name, USART1);
+	uputs((U8 *)" ", USART1);
+	uputs(p, USART1);
+	uputs((U8 *)"\n", USART1);
+}
+
+void bench_run(void)
+{
+	const struct bench *b;
+	U32 start, cycles, best;
+	U8 i;
+
+	bench_frame();
+
+	for(b = benches; b < benches + sizeof(benches) / sizeof(benches[0]); ++b) {
+		if(b->setup)
+			b->setup();
+		best = 0xFFFFFFFF;
+		for(i = 0; i < BENCH_RUNS; ++i) {
+			start = DWT_CYCCNT;
+			b->run();
+			cycles = DWT_CYCCNT - start;
+			if(cycles < best)
+				best = cycles;
+		}
+		bench_print(b->name, best);
+	}
+
+	bench_print("peak_budget", 2 * PEAK_CLKS * PEAK_DECIM_MAX);
+
+	avg_config(0);
+	dso_scope.acq_mode = ACQ_SINGLE;
+	clr_screen();
+	render_invalidate();
+}
+
+#endif
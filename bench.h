@@ -0,0 +1,23 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * DWT cycle counts of the hot paths, built with "make BENCH=1".
+ *
+ * bench_run() is called once the display, USART1 and the scheduler (which
+ * starts the cycle counter) are up. Every case runs BENCH_RUNS times, the
+ * fastest run is printed over USART1 as "bench <name> <cycles>", then the
+ * screen is cleared and the scope starts as usual. Some cases keep the
+ * code they replaced as a reference, peak_budget is the deadline of the
+ * peak_* cases.
+ */
+#define BENCH_RUNS		8
+#define BENCH_FILL		100		/* Fill rect side, pixels */
+
+void bench_run(void);
+
+#endif
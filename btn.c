@@ -0,0 +1,55 @@
+#include "stm32f10x.h"
+
+#include "btn.h"
+#include "scope.h"
+#include "loop.h"
+#include "Common.h"
+
+struct btn btn;
+
+#define BTN_MASK		((1 << BTN_NR) - 1)
+#define BTN_LONG_SCANS		(BTN_LONG_MS / BTN_SCAN_MS)
+#define BTN_REPEAT_SCANS	(BTN_REPEAT_MS / BTN_SCAN_MS)
+
+void btn_config(void)
+{
+	btn.state = 0;
+	btn.cnt0 = 0;
+	btn.cnt1 = 0;
+	btn.scan = BTN_SCAN_MS;
+}
+
+/* SysTick, the buttons are pulled up and read low when pressed */
+void btn_tick(void)
+{
+	U8 raw, diff, i;
+
+	if(--btn.scan)
+		return;
+	btn.scan = BTN_SCAN_MS;
+
+	raw = ~(GPIO_ReadInputData(BTN_PORT) >> BTN_PIN_FIRST) & BTN_MASK;
+
+	/*
+	 * Counters of the pins that agree with the state restart, the others
+	 * count up, a pin flips when its counter wraps after BTN_STABLE scans.
+	 */
+	diff = raw ^ btn.state;
+	btn.cnt1 = (btn.cnt1 ^ btn.cnt0) & diff;
+	btn.cnt0 = ~btn.cnt0 & diff;
+	diff &= ~(btn.cnt0 | btn.cnt1);
+	btn.state ^= diff;
+
+	for(i = 0; i < BTN_NR; ++i) {
+		if(BitTest(diff, (1 << i))) {
+			btn.held[i] = 0;
+			loop_post(EV_BUTTON, BTN_ARG(i,
+				BitTest(btn.state, (1 << i)) ? BTN_PRESS : BTN_RELEASE));
+		} else if(BitTest(btn.state, (1 << i))) {
+			if(++btn.held[i] == BTN_LONG_SCANS + BTN_REPEAT_SCANS)
+				btn.held[i] = BTN_LONG_SCANS;
+			if(btn.held[i] == BTN_LONG_SCANS)
+				loop_post(EV_BUTTON, BTN_ARG(i, BTN_LONG));
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef BTN_H
+#define BTN_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * Button debouncer, PB12..PB15 scanned from the 1ms SysTick, see loop.h.
+ *
+ * The four pins are debounced together as a vertical counter: every button
+ * has a 2 bit counter split over the cnt0/cnt1 bit planes and a pin that
+ * disagrees with the debounced state for BTN_STABLE scans in a row flips it.
+ * Flips post press and release events, a button held for BTN_LONG_MS posts
+ * a long press that repeats every BTN_REPEAT_MS until the release.
+ * The events go to the main loop ring as EV_BUTTON, see loop.h.
+ */
+#define BTN_SCAN_MS		5	/* Debounce time BTN_STABLE * BTN_SCAN_MS */
+#define BTN_STABLE		4	/* Fixed by the 2 bit counters */
+#define BTN_LONG_MS		600
+#define BTN_REPEAT_MS		150
+
+/* Button index is the pin number - BTN_PIN_FIRST */
+#define BTN_PIN_FIRST		12
+#define BTN_NR			4
+#define BTN_IDX(pin)		(__builtin_ctz(pin) - BTN_PIN_FIRST)
+
+/* EV_BUTTON arg */
+#define BTN_ARG(i, ev)		(((ev) << 4) | (i))
+#define BTN_ARG_IDX(arg)	((arg) & 0x0F)
+#define BTN_ARG_EV(arg)		((arg) >> 4)
+
+enum btn_event {
+	BTN_PRESS,
+	BTN_RELEASE,
+	BTN_LONG,
+	BTN_EVENTS_NR
+};
+
+struct btn {
+	U8 state;			/* Debounced, a set bit is pressed */
+	U8 cnt0;			/* Vertical counter bit planes */
+	U8 cnt1;
+	U8 scan;			/* Ticks to the next scan */
+	U16 held[BTN_NR];		/* Scans since the press */
+};
+
+void btn_config(void);
+void btn_tick(void);
+
+#endif
@@ -0,0 +1,199 @@
+#include "stm32f10x.h"
+
+#include "fft.h"
+#include "render.h"
+#include "scope.h"
+#include "Common.h"
+
+struct fft fft;
+
+extern struct scope dso_scope;
+extern struct waveform wave;
+
+/* sin(2 * pi * k / FFT_N) in Q15, first quarter */
+static const S16 fft_sin_q[FFT_N / 4 + 1] = {
+	0, 804, 1608, 2410, 3212, 4011, 4808, 5602,
+	6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+	12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+	18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+	23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+	27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+	30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+	32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+	32767,
+};
+
+/* Flat-top cosine terms a0..a4 in Q15 */
+static const S16 fft_flattop[5] = { 7064, 13652, 9085, 2739, 228 };
+
+/* 256 * log2(1 + i / 16) */
+static const U8 fft_log2_frac[16] = {
+	0, 22, 44, 63, 82, 100, 118, 134, 150, 165, 179, 193, 207, 220, 232, 244
+};
+
+/* dB of a full swing sine with no window, and what each window loses, 1/256 dB */
+#define FFT_DB_REF		20037
+static const S16 fft_window_gain[FFT_WINDOWS_NR] = { 1541, 3412 };
+
+/* sin(2 * pi * k / FFT_N) and cos, any k */
+static S16 fft_sin(U16 k)
+{
+	k &= FFT_N - 1;
+	if(k <= FFT_N / 4)
+		return fft_sin_q[k];
+	if(k <= FFT_N / 2)
+		return fft_sin_q[FFT_N / 2 - k];
+	if(k <= 3 * FFT_N / 4)
+		return -fft_sin_q[k - FFT_N / 2];
+	return -fft_sin_q[FFT_N - k];
+}
+
+#define fft_cos(k)		fft_sin((k) + FFT_N / 4)
+
+/* Window value of sample [n] in Q15 */
+static S16 fft_window(U16 n)
+{
+	S32 w;
+
+	if(fft.window == FFT_HANN)
+		return (32768 - fft_cos(n)) >> 1;
+
+	w = fft_flattop[0]
+		- (((S32)fft_flattop[1] * fft_cos(n)) >> 15)
+		+ (((S32)fft_flattop[2] * fft_cos(2 * n)) >> 15)
+		- (((S32)fft_flattop[3] * fft_cos(3 * n)) >> 15)
+		+ (((S32)fft_flattop[4] * fft_cos(4 * n)) >> 15);
+	return (w > 32767) ? 32767 : w;
+}
+
+/* 256 * log2(v), v > 0 */
+static S32 fft_log2(U32 v)
+{
+	U8 lz = __builtin_clz(v);
+
+	return ((S32)(31 - lz) << 8) + fft_log2_frac[((v << lz) >> 27) & 15];
+}
+
+/* FFT_OFF or one of the windows, the trace comes back with FFT_OFF */
+void fft_config(U8 window)
+{
+	U8 on = (window != FFT_OFF);
+
+	if(on == fft.on && window == fft.window)
+		return;
+
+	fft.on = on;
+	if(on)
+		fft.window = window;
+	for(U16 k = 0; k < FFT_BINS; ++k)
+		fft.db[k] = FFT_DB_MIN;
+	fft.peak = 0;
+	render_invalidate();
+}
+
+/* Spectrum of the front buffer, call once per new frame */
+void fft_frame(void)
+{
+	U16 i, j, k, len, half, step, a, b;
+	S32 x, mean = 0, tr, ti, wr, wi, db, p0, p1, p2;
+	U32 power;
+	S16 tmp;
+
+	if(!fft.on)
+		return;
+
+	/* Samples without their mean, ADC counts to Q15 */
+	for(i = 0; i < FFT_N; ++i) {
+		x = FRAME_ADC(wave.display_buf[i]);
+		if(wave.display_peak)
+			x = (x + wave.display_min[i]) >> 1;
+		fft.re[i] = x;
+		mean += x;
+	}
+	mean /= FFT_N;
+
+	for(i = 0; i < FFT_N; ++i) {
+		x = (fft.re[i] - mean) << 3;
+		fft.re[i] = (x * fft_window(i)) >> 15;
+		fft.im[i] = 0;
+	}
+
+	/* Bit reversed order */
+	for(i = 1, j = 0; i < FFT_N; ++i) {
+		for(k = FFT_N >> 1; j & k; k >>= 1)
+			j ^= k;
+		j |= k;
+		if(i < j) {
+			tmp = fft.re[i];
+			fft.re[i] = fft.re[j];
+			fft.re[j] = tmp;
+		}
+	}
+
+	/* Decimation in time butterflies, halved each stage */
+	for(len = 2; len <= FFT_N; len <<= 1) {
+		half = len >> 1;
+		step = FFT_N / len;
+		for(j = 0; j < half; ++j) {
+			wr = fft_cos(j * step);
+			wi = -fft_sin(j * step);
+			for(a = j; a < FFT_N; a += len) {
+				b = a + half;
+				tr = (fft.re[b] * wr - fft.im[b] * wi) >> 15;
+				ti = (fft.re[b] * wi + fft.im[b] * wr) >> 15;
+				fft.re[b] = (fft.re[a] - tr) >> 1;
+				fft.im[b] = (fft.im[a] - ti) >> 1;
+				fft.re[a] = (fft.re[a] + tr) >> 1;
+				fft.im[a] = (fft.im[a] + ti) >> 1;
+			}
+		}
+	}
+
+	/* Powers to dB, the peak skips DC and its leakage */
+	fft.peak = 2;
+	for(k = 0; k < FFT_BINS; ++k) {
+		power = (U32)((S32)fft.re[k] * fft.re[k]) + (U32)((S32)fft.im[k] * fft.im[k]);
+		db = FFT_DB_MIN;
+		if(power) {
+			/* 10 * log10(p) = 3.0103 * log2(p) */
+			db = ((fft_log2(power) * 771) >> 8) - FFT_DB_REF + fft_window_gain[fft.window];
+			if(db < FFT_DB_MIN)
+				db = FFT_DB_MIN;
+		}
+		fft.db[k] = db;
+		if(k > 2 && db > fft.db[fft.peak])
+			fft.peak = k;
+	}
+
+	/* Parabola through the peak and its neighbours */
+	fft.peak_ofs = 0;
+	if(fft.peak < FFT_BINS - 1) {
+		p0 = fft.db[fft.peak - 1];
+		p1 = fft.db[fft.peak];
+		p2 = fft.db[fft.peak + 1];
+		if(p0 - 2 * p1 + p2 < 0)
+			fft.peak_ofs = ((p0 - p2) * 128) / (p0 - 2 * p1 + p2);
+	}
+}
+
+/* Screen row of the top of the bar in wave display column [c] */
+U8 fft_top(U16 c)
+{
+	S32 db = fft.db[(U32)c * FFT_BINS / RENDER_COLS];
+
+	if(db > 0)
+		db = 0;
+	return RENDER_BOTTOM - (db - FFT_DB_MIN) * (WD_HEIGHT - 1) / (FFT_DB_RANGE * 256);
+}
+
+/* Frequency of the strongest bin in mHz, 0 if the spectrum is flat */
+U32 fft_peak_mhz(void)
+{
+	S32 pos = ((S32)fft.peak << 8) + fft.peak_ofs;
+
+	if(!fft.on || fft.db[fft.peak] <= FFT_DB_MIN || pos <= 0)
+		return 0;
+
+	/* SAMPLES_NR / TB_DIVS samples per division of [timebase] us */
+	return (U64)pos * (1000000000ULL * SAMPLES_NR / TB_DIVS) / ((U64)dso_scope.timebase * FFT_N * 256);
+}
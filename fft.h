@@ -0,0 +1,47 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+#include "scope.h"
+
+/*
+ * Spectrum display, a Q15 radix-2 FFT of the front buffer.
+ *
+ * The first FFT_N samples lose their mean, get windowed and transformed
+ * in place with a halving per stage, so nothing can overflow and the
+ * result is scaled by 1/FFT_N. Bin powers go to dB below full scale (a
+ * full swing sine reads 0 dB with either window), the renderer shows them
+ * as bars over FFT_DB_RANGE, 10 dB per grid division.
+ */
+#define FFT_N			256
+#define FFT_LOG2_N		8
+#define FFT_BINS		(FFT_N / 2)
+#define FFT_DB_RANGE		80		/* dB from the top to the bottom of the display */
+#define FFT_DB_MIN		(-FFT_DB_RANGE * 256)
+
+/* Windows */
+#define FFT_HANN		0
+#define FFT_FLATTOP		1
+#define FFT_WINDOWS_NR		2
+#define FFT_OFF			0xFF
+
+struct fft {
+	S16 re[FFT_N];
+	S16 im[FFT_N];
+	S16 db[FFT_BINS];	/* 1/256 dB below full scale, FFT_DB_MIN floor */
+	U8 peak;		/* Strongest bin but DC */
+	S16 peak_ofs;		/* Its interpolated offset, 1/256 bins */
+	U8 on;
+	U8 window;
+};
+
+extern struct fft fft;
+
+void fft_config(U8 window);
+void fft_frame(void);
+U8 fft_top(U16 c);
+U32 fft_peak_mhz(void);
+
+#endif
@@ -0,0 +1,168 @@
+#include "stm32f10x.h"
+
+#include "freqcnt.h"
+#include "Common.h"
+
+struct freqcnt fc;
+
+/* Fastest first */
+static const struct fc_range {
+	U16 psc;		/* TIM1 prescaler */
+	U16 icpsc;		/* Input capture prescaler */
+	U8 div;			/* Signal periods per capture */
+	U8 edges;		/* Captures per measurement */
+	U16 fast;		/* Mean capture difference below: use the faster range */
+} fc_ranges[FC_RANGES_NR] = {
+	{ 0, TIM_ICPSC_DIV8, 8, FC_EDGES, 0 },		/* Above ~70kHz */
+	{ 0, TIM_ICPSC_DIV1, 1, FC_EDGES, 1024 },	/* ~1.1kHz to ~70kHz */
+	{ 71, TIM_ICPSC_DIV1, 1, 17, 455 },		/* ~16Hz to ~2.2kHz, 1us ticks */
+	{ 1099, TIM_ICPSC_DIV1, 1, 3, 1024 }		/* ~1Hz to ~64Hz */
+};
+
+/* Start the next burst of captures in the current range */
+static void freqcnt_start(void)
+{
+	const struct fc_range *r = &fc_ranges[fc.range];
+
+	TIM_Cmd(TIM1, DISABLE);
+	DMA_Cmd(DMA1_Channel2, DISABLE);
+
+	DMA1_Channel2->CNDTR = r->edges;
+	DMA_ClearITPendingBit(DMA1_IT_GL2);
+
+	TIM_PrescalerConfig(TIM1, r->psc, TIM_PSCReloadMode_Immediate);
+	TIM_SetIC1Prescaler(TIM1, r->icpsc);
+	TIM_SetCounter(TIM1, 0);
+	TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+	TIM_ClearFlag(TIM1, TIM_FLAG_CC1 | TIM_FLAG_CC1OF);
+	fc.ovf = 0;
+	fc.wraps = 0;
+
+	DMA_Cmd(DMA1_Channel2, ENABLE);
+	TIM_Cmd(TIM1, ENABLE);
+}
+
+void freqcnt_config(void)
+{
+	TIM_TimeBaseInitTypeDef TIM_struct;
+	TIM_ICInitTypeDef IC_struct;
+	DMA_InitTypeDef DMA_init;
+
+	/* TIM1 free running, CH1 captures the rising edges of TrigIn */
+	TIM_TimeBaseStructInit(&TIM_struct);
+	TIM_struct.TIM_Period = 0xFFFF;
+	TIM_struct.TIM_Prescaler = 0;
+	TIM_struct.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_TimeBaseInit(TIM1, &TIM_struct);
+
+	TIM_ICStructInit(&IC_struct);
+	IC_struct.TIM_Channel = TIM_Channel_1;
+	IC_struct.TIM_ICPolarity = TIM_ICPolarity_Rising;
+	IC_struct.TIM_ICSelection = TIM_ICSelection_DirectTI;
+	IC_struct.TIM_ICPrescaler = TIM_ICPSC_DIV1;
+	IC_struct.TIM_ICFilter = FC_IC_FILTER;
+	TIM_ICInit(TIM1, &IC_struct);
+
+	/* Every capture goes to fc.cap[], TIM1_CH1 is DMA1 channel 2 */
+	DMA_DeInit(DMA1_Channel2);
+	DMA_init.DMA_PeripheralBaseAddr = (U32)&TIM1->CCR1;
+	DMA_init.DMA_MemoryBaseAddr = (U32)fc.cap;
+	DMA_init.DMA_DIR = DMA_DIR_PeripheralSRC;
+	DMA_init.DMA_BufferSize = FC_EDGES;
+	DMA_init.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_init.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_init.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+	DMA_init.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+	DMA_init.DMA_Mode = DMA_Mode_Normal;
+	DMA_init.DMA_Priority = DMA_Priority_Medium;
+	DMA_init.DMA_M2M = DMA_M2M_Disable;
+	DMA_Init(DMA1_Channel2, &DMA_init);
+	DMA_ITConfig(DMA1_Channel2, DMA_IT_TC, ENABLE);
+
+	TIM_DMACmd(TIM1, TIM_DMA_CC1, ENABLE);
+	TIM_ITConfig(TIM1, TIM_IT_Update, ENABLE);
+
+	fc.range = FC_RANGE_START;
+	fc.ticks = 0;
+	fc.periods = 0;
+	freqcnt_start();
+}
+
+/* DMA transfer complete, all captures of the burst are in */
+void freqcnt_done(void)
+{
+	const struct fc_range *r = &fc_ranges[fc.range];
+	U32 sum = 0;
+	U16 i;
+
+	/* Modulo 2^16 differences, valid as long as every one fits the counter */
+	for(i = 1; i < r->edges; ++i)
+		sum += (U16)(fc.cap[i] - fc.cap[i - 1]);
+
+	if(fc.ovf > ((fc.cap[0] + sum) >> 16) + 1) {
+		/* A period was longer than the counter */
+		if(fc.range < FC_RANGES_NR - 1)
+			++fc.range;
+	} else {
+		fc.ticks = sum * (r->psc + 1);
+		fc.periods = (r->edges - 1) * r->div;
+
+		if(sum / (r->edges - 1) < r->fast)
+			--fc.range;
+	}
+
+	freqcnt_start();
+}
+
+/* TIM1 update, extends the counter while the captures are collected */
+void freqcnt_wrap(void)
+{
+	const struct fc_range *r = &fc_ranges[fc.range];
+
+	if(DMA_GetCurrDataCounter(DMA1_Channel2) < r->edges)
+		++fc.ovf;
+
+	/*
+	 * Not enough edges in about twice the slowest expected burst. The last
+	 * result is dropped at once, the slower ranges take seconds to time out.
+	 */
+	if(++fc.wraps > 2 * r->edges + 2) {
+		fc.ticks = 0;
+		if(fc.range < FC_RANGES_NR - 1)
+			++fc.range;
+		freqcnt_start();
+	}
+}
+
+/* Take a consistent copy of the last result */
+static void freqcnt_read(U32 *ticks, U32 *periods)
+{
+	NVIC_DisableIRQ(DMA1_Channel2_IRQn);
+	NVIC_DisableIRQ(TIM1_UP_IRQn);
+	*ticks = fc.ticks;
+	*periods = fc.periods;
+	NVIC_EnableIRQ(TIM1_UP_IRQn);
+	NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+}
+
+/* Frequency in Hz, 0 if there is no signal */
+double freqcnt_freq(void)
+{
+	U32 ticks, periods;
+
+	freqcnt_read(&ticks, &periods);
+	if(!ticks)
+		return 0;
+	return (double)periods * FC_TIM_HZ / ticks;
+}
+
+/* Period in microseconds, 0 if there is no signal */
+double freqcnt_period_us(void)
+{
+	U32 ticks, periods;
+
+	freqcnt_read(&ticks, &periods);
+	if(!ticks)
+		return 0;
+	return (double)ticks * 1000000 / FC_TIM_HZ / periods;
+}
@@ -0,0 +1,42 @@
+#ifndef FREQCNT_H
+#define FREQCNT_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * Reciprocal frequency counter on TrigIn (PA8, TIM1_CH1).
+ *
+ * TIM1 timestamps the rising edges by input capture and DMA (channel 2)
+ * collects a burst of FC_EDGES captures. The transfer complete interrupt
+ * sums the capture differences, so the result is the time of a whole
+ * number of signal periods and the resolution doesn't depend on the
+ * frequency or the timebase. The TIM1 update interrupt catches periods
+ * too long for the 16 bit counter and a missing signal, both move to a
+ * slower range: a bigger TIM1 prescaler and fewer edges.
+ */
+#define FC_TIM_HZ		72000000
+#define FC_EDGES		33	/* Captures per measurement, most ranges */
+#define FC_RANGES_NR		4
+#define FC_RANGE_START		1
+#define FC_IC_FILTER		0x3
+
+struct freqcnt {
+	__IO U16 cap[FC_EDGES];		/* DMA destination, TIM1 CCR1 */
+	__IO U16 ovf;			/* TIM1 wraps since the first capture */
+	__IO U16 wraps;			/* TIM1 wraps since the start, no signal timeout */
+	__IO U8 range;			/* Index to fc_ranges[] */
+
+	/* Last result, 0 ticks if there is no signal */
+	__IO U32 ticks;			/* FC_TIM_HZ clocks over [periods] */
+	__IO U16 periods;
+};
+
+void freqcnt_config(void);
+void freqcnt_done(void);
+void freqcnt_wrap(void);
+double freqcnt_freq(void);
+double freqcnt_period_us(void);
+
+#endif
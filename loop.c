@@ -0,0 +1,101 @@
+#include "stm32f10x.h"
+
+#include "loop.h"
+#include "Common.h"
+
+struct loop loop;
+
+void loop_config(void)
+{
+	loop.head = loop.tail = 0;
+	loop.lost = 0;
+	loop.sleeping = 0;
+	loop.frame_ms = LOOP_FRAME_MS;
+	loop.stats_ms = LOOP_STATS_MS;
+	loop.idle_ms = 0;
+	loop.frames = loop.frames_last = 0;
+	loop.period = 0;
+	loop.fps = 0;
+	loop.idle = 0;
+
+	/* Same priority as the other producers, see loop.h */
+	SysTick_Config(SystemCoreClock / LOOP_TICK_HZ);
+	NVIC_SetPriority(SysTick_IRQn, 0);
+}
+
+/* Interrupt side, 0 if the ring is full */
+U8 loop_post(U8 type, U8 arg)
+{
+	U8 head = loop.head;
+	__IO struct event *ev;
+
+	if((U8)(head - loop.tail) == LOOP_EVENTS_NR) {
+		++loop.lost;
+		return 0;
+	}
+
+	ev = &loop.ring[head & (LOOP_EVENTS_NR - 1)];
+	ev->type = type;
+	ev->arg = arg;
+	loop.head = head + 1;
+	return 1;
+}
+
+/* Main loop side, 0 if the ring is empty */
+U8 loop_get(struct event *ev)
+{
+	U8 tail = loop.tail;
+
+	if(tail == loop.head)
+		return 0;
+
+	ev->type = loop.ring[tail & (LOOP_EVENTS_NR - 1)].type;
+	ev->arg = loop.ring[tail & (LOOP_EVENTS_NR - 1)].arg;
+	loop.tail = tail + 1;
+	return 1;
+}
+
+/* SysTick, 1ms */
+void loop_tick(void)
+{
+	if(loop.sleeping)
+		++loop.idle_ms;
+
+	if(!--loop.frame_ms) {
+		loop.frame_ms = LOOP_FRAME_MS;
+		loop_post(EV_FRAME, 0);
+	}
+
+	if(!--loop.stats_ms) {
+		loop.stats_ms = LOOP_STATS_MS;
+		loop.fps = loop.frames - loop.frames_last;
+		loop.frames_last = loop.frames;
+		loop.idle = loop.idle_ms * 100 / LOOP_STATS_MS;
+		loop.idle_ms = 0;
+		++loop.period;
+	}
+}
+
+/*
+ * Sleep until the ring holds an event. WFI wakes on a pending interrupt
+ * even with the interrupts masked, so a post between the test and the WFI
+ * isn't slept through. The interrupt then runs with sleeping still set.
+ */
+void loop_wait(void)
+{
+	__disable_irq();
+	while(loop.tail == loop.head) {
+		loop.sleeping = 1;
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+		loop.sleeping = 0;
+	}
+	__enable_irq();
+}
+
+/* A frame was drawn */
+void loop_frame(void)
+{
+	++loop.frames;
+}
@@ -0,0 +1,72 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * Main loop events.
+ *
+ * Interrupts post typed events to a ring and the main loop sleeps with WFI
+ * while it is empty. The ring is single producer, single consumer: every
+ * posting interrupt, SysTick included, runs at priority 0 so none of them
+ * preempts another and together they are the one producer, the main loop
+ * is the consumer. The producer only writes head, the consumer only tail,
+ * so neither side needs the interrupts off and the events keep their order.
+ * A full ring drops the new event and counts it in lost.
+ *
+ * SysTick posts EV_FRAME every LOOP_FRAME_MS, a frame is drawn on the first
+ * one after a completed capture. It also samples whether it woke the core
+ * from loop_wait(), over LOOP_STATS_MS that is the idle time, and latches
+ * the frames drawn. The task loads follow period, see sched.h.
+ */
+#define LOOP_TICK_HZ		1000	/* SysTick */
+#define LOOP_FRAME_MS		20	/* Shortest frame, 50fps */
+#define LOOP_STATS_MS		1000	/* fps and idle readout period */
+#define LOOP_EVENTS_NR		32	/* Ring size, a power of 2 below 256 */
+
+enum loop_event {
+	EV_FRAME,		/* SysTick, a frame is due */
+	EV_CAPTURE,		/* TIM2, capture_done(), arg CAPT_* */
+	EV_TRIG_TIMEOUT,	/* TIM2, auto trigger, the next capture is untriggered */
+	EV_BUTTON,		/* SysTick, arg BTN_ARG(), see btn.h */
+	EV_SERIAL,		/* USART1, the rx ring has data, see uart.h */
+	EVENTS_NR
+};
+
+/* EV_CAPTURE arg */
+#define CAPT_SINGLE		0x01	/* Single shot, the chain stopped */
+
+struct event {
+	U8 type;
+	U8 arg;
+};
+
+struct loop {
+	__IO struct event ring[LOOP_EVENTS_NR];
+	__IO U8 head;			/* Next post, interrupts only */
+	__IO U8 tail;			/* Next loop_get(), main loop only */
+	__IO U8 lost;			/* Posted to a full ring */
+
+	__IO U8 sleeping;		/* The core is in loop_wait() */
+	U8 frame_ms;			/* Ticks to the next EV_FRAME */
+	U16 stats_ms;			/* Ticks to the next readout */
+	U16 idle_ms;			/* Sleeping ticks this period */
+	__IO U16 frames;		/* Drawn, main loop counter */
+	U16 frames_last;		/* frames at the last readout */
+
+	/* Last period */
+	__IO U8 period;			/* Counts the readouts */
+	__IO U8 fps;
+	__IO U8 idle;			/* Percent */
+};
+
+void loop_config(void);
+U8 loop_post(U8 type, U8 arg);
+U8 loop_get(struct event *ev);
+void loop_tick(void);
+void loop_wait(void);
+void loop_frame(void);
+
+#endif
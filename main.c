@@ -7,11 +7,69 @@
 #include "Screen.h"
 #include "Eeprom.h"
 #include "scope.h"
+#include "avg.h"
+#include "persist.h"
+#include "measure.h"
+#include "fft.h"
+#include "loop.h"
+#include "sched.h"
+#include "uart.h"
+#include "bench.h"
 #include "stdlib.h"
 
 extern __IO struct waveform wave;
 extern __IO struct scope dso_scope;
-extern __IO U16 timebase_vals[];
+
+static U8 frame_due;
+
+/* Take the last captured frame and keep the capture running */
+static void acquire_task(void)
+{
+	sched_frame();
+
+	if(frame_swap()) {
+		frame_align();
+		if(!wave.display_peak)
+			avg_frame(wave.display_buf);
+		sched_ready(TASK_MEASURE);
+		loop_frame();
+	}
+
+	/* Start sampling */
+	sampling_enable();
+
+	sched_ready(TASK_TRACE);
+	sched_ready(TASK_INFO);
+}
+
+/* Buttons and serial commands don't wait for the frame */
+static void ui_task(void)
+{
+	struct event ev;
+
+	while(loop_get(&ev)) {
+		if(ev.type == EV_FRAME)
+			frame_due = 1;
+		else
+			scope_event(&ev);
+	}
+
+	/* Bytes whose EV_SERIAL didn't fit the ring */
+	uart_poll();
+
+	/* Draw on the first frame tick after a capture */
+	if(frame_due && dso_scope.done_sampling) {
+		frame_due = 0;
+		sched_ready(TASK_ACQUIRE);
+	}
+}
+
+static void measure_task(void)
+{
+	persist_frame();
+	meas_frame();
+	fft_frame();
+}
 
 int main (void)
 {
@@ -30,13 +88,25 @@ int main (void)
 
 	/* Init display */
 	TFT_Init_Ili9341();
+	TFT_DMA_Init();
 	 
 	/* Init USART1 */
 	USART1_Init();
+	uart_config();
 	
 	clr_screen();
 
 	/* Initialization */
+	loop_config();
+	sched_config();
+	sched_add(TASK_ACQUIRE, acquire_task, 0);
+	sched_add(TASK_UI, ui_task, 0);
+	sched_add(TASK_MEASURE, measure_task, 0);
+	sched_add(TASK_TRACE, waveform_display, 0);
+	sched_add(TASK_INFO, info_display, SCHED_INFO_SKIPS);
+#ifdef BENCH
+	bench_run();
+#endif
 	scope_init();
 	waveform_init();
 	
@@ -46,32 +116,15 @@ int main (void)
 	sampling_config();
 	uputs("Configured sampling\n", USART1);
 	
-	timebase_display(timebase_vals[dso_scope.tb_i]);
+	timebase_display(1);
  	dso_scope.done_sampling = 1;
 	
-	/* Main loop */
+	/* Main loop, sleeps until an interrupt posts an event, see loop.h and sched.h */
 	while(1) {
-		while(!dso_scope.done_sampling)
-			;
-		/*char buf[16];
-		itoa(ADC_GetConversionValue(ADC1), buf, 10);
-		uputs(buf, USART1);
-		*/
-
-		/* Read buttons */
-		read_btns();
-		
-		/* Prepare sampling operation */
-		fill_display_buf();
-
-		/* Start sampling */
-		sampling_enable();
-
-		waveform_display();
-		info_display();
-		//for(int i = 0 ; i < ; i++)
-			Delay(35000);
-		dso_scope.done_displaying = 1;
+		loop_wait();
+
+		sched_ready(TASK_UI);
+		sched_run();
 	}
 }	
 
@@ -0,0 +1,153 @@
+#include "stm32f10x.h"
+
+#include "measure.h"
+#include "scope.h"
+#include "Common.h"
+
+struct measure meas;
+
+extern struct scope dso_scope;
+extern struct waveform wave;
+
+/* Nanoseconds per sample times SAMPLES_NR, timebase is in us per division */
+#define SAMPLE_NS_N(tb)		((U64)(tb) * 1000 * TB_DIVS)
+
+#define MEAS_NONE		0
+#define MEAS_LOW		1
+#define MEAS_HIGH		2
+
+/* Integer square root, bit by bit */
+static U16 meas_isqrt(U32 v)
+{
+	U32 root = 0, bit = 1UL << 30;
+
+	while(bit > v)
+		bit >>= 2;
+	while(bit) {
+		if(v >= root + bit) {
+			v -= root + bit;
+			root = (root >> 1) + bit;
+		} else
+			root >>= 1;
+		bit >>= 2;
+	}
+	return root;
+}
+
+/*
+ * Where the line from sample i - 1 at [a] to sample [i] at [b] crosses
+ * [level], in 1/MEAS_FRAC samples. [level] must lie between a and b.
+ */
+U32 meas_cross(U16 a, U16 b, U16 level, U16 i)
+{
+	U32 pos = (U32)(i - 1) << MEAS_FRAC_BITS;
+
+	if(a == b)
+		return pos;
+	if(a < b)
+		return pos + ((U32)(level - a) << MEAS_FRAC_BITS) / (b - a);
+	return pos + ((U32)(a - level) << MEAS_FRAC_BITS) / (a - b);
+}
+
+/* Measure the front buffer, call once per new frame */
+void meas_frame(void)
+{
+	U16 i, hi, lo, x, prev = 0, min = ADC_MAX, max = 0, swing;
+	U16 rises = 0, rise_n = 0, fall_n = 0, highs = 0;
+	U32 mid_at = 0, lo_at = 0, hi_at = 0, rise_at = 0, first = 0, last = 0;
+	U32 sum = 0, rise_sum = 0, fall_sum = 0, high_sum = 0;
+	U64 squares = 0;
+	U8 state = MEAS_NONE, high = 0;
+
+	for(i = 0; i < SAMPLES_NR; ++i) {
+		hi = FRAME_ADC(wave.display_buf[i]);
+		lo = wave.display_peak ? wave.display_min[i] : hi;
+		x = (hi + lo) >> 1;
+
+		if(hi > max)
+			max = hi;
+		if(lo < min)
+			min = lo;
+		sum += x;
+		squares += (U32)x * x;
+
+		if(!meas.hi)
+			continue;
+
+		if(i) {
+			/* Last crossing of the middle, where an edge is placed */
+			if((prev < meas.mid) != (x < meas.mid))
+				mid_at = meas_cross(prev, x, meas.mid, i);
+			/* Where a rise leaves MEAS_LO, a fall leaves MEAS_HI */
+			if(prev <= meas.lo && x > meas.lo)
+				lo_at = meas_cross(prev, x, meas.lo, i);
+			if(prev >= meas.hi && x < meas.hi)
+				hi_at = meas_cross(prev, x, meas.hi, i);
+		}
+
+		if(x <= meas.lo) {
+			if(state == MEAS_HIGH) {
+				fall_sum += meas_cross(prev, x, meas.lo, i) - hi_at;
+				++fall_n;
+				if(high) {
+					high_sum += mid_at - rise_at;
+					++highs;
+				}
+			}
+			state = MEAS_LOW;
+		} else if(x >= meas.hi) {
+			if(state == MEAS_LOW) {
+				rise_sum += meas_cross(prev, x, meas.hi, i) - lo_at;
+				++rise_n;
+				if(!rises++)
+					first = mid_at;
+				last = mid_at;
+				rise_at = mid_at;
+				high = 1;
+			}
+			state = MEAS_HIGH;
+		}
+		prev = x;
+	}
+
+	meas.min = min;
+	meas.max = max;
+	meas.avg = (sum + SAMPLES_NR / 2) / SAMPLES_NR;
+	meas.rms = meas_isqrt(squares / SAMPLES_NR);
+
+	meas.edges = rises;
+	meas.period = (rises > 1) ? (last - first) / (rises - 1) : 0;
+	meas.rise = rise_n ? rise_sum / rise_n : 0;
+	meas.fall = fall_n ? fall_sum / fall_n : 0;
+	meas.duty = (meas.period && highs) ? (high_sum / highs) * 1000 / meas.period : 0;
+
+	/* Thresholds for the next frame */
+	swing = max - min;
+	if(max < min || swing < MEAS_MIN_SWING) {
+		meas.hi = 0;
+		return;
+	}
+	meas.lo = min + (U32)swing * MEAS_LO / 100;
+	meas.mid = min + (U32)swing * MEAS_MID / 100;
+	meas.hi = min + (U32)swing * MEAS_HI / 100;
+}
+
+/* Time [t] in 1/MEAS_FRAC samples to nanoseconds at the current timebase */
+U32 meas_time_ns(U32 t)
+{
+	U64 ns = ((U64)t * SAMPLE_NS_N(dso_scope.timebase) / SAMPLES_NR) >> MEAS_FRAC_BITS;
+
+	return (ns > 0xFFFFFFFF) ? 0xFFFFFFFF : ns;
+}
+
+/* Frequency from the period in mHz, 0 if there is none */
+U32 meas_freq_mhz(void)
+{
+	U64 f;
+
+	if(!meas.period)
+		return 0;
+
+	f = (1000000000000ULL * SAMPLES_NR << MEAS_FRAC_BITS) / (meas.period * SAMPLE_NS_N(dso_scope.timebase));
+	return (f > 0xFFFFFFFF) ? 0xFFFFFFFF : f;
+}
@@ -0,0 +1,50 @@
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+#include "scope.h"
+
+/*
+ * Waveform measurements, one integer pass over the front buffer.
+ *
+ * Levels come straight from the pass. Edges are found against the
+ * thresholds of the previous frame, so a single pass is enough; after a
+ * big change of the signal the times settle with the next frame. An edge
+ * needs the signal to go from below MEAS_LO to above MEAS_HI percent of
+ * the swing (or back), its position is the last crossing of MEAS_MID.
+ * Crossings are interpolated between the samples on either side.
+ *
+ * Times are in 1/MEAS_FRAC sample units, meas_time_ns() converts them.
+ */
+#define MEAS_LO			10		/* Percent of the swing */
+#define MEAS_MID		50
+#define MEAS_HI			90
+#define MEAS_MIN_SWING		(2 * NOISE_MARGIN)	/* Smaller swings have no edges */
+#define MEAS_FRAC_BITS		8
+#define MEAS_FRAC		(1 << MEAS_FRAC_BITS)
+
+struct measure {
+	/* ADC units */
+	U16 min, max;
+	U16 avg, rms;
+
+	/* 1/MEAS_FRAC samples, 0 if not found */
+	U32 period;		/* Between rising edges */
+	U32 rise, fall;		/* MEAS_LO to MEAS_HI, averaged over the edges */
+	U16 duty;		/* 0.1 %, 0 if unknown */
+	U8 edges;		/* Rising edges in the frame */
+
+	/* Thresholds for the next frame, hi is 0 if the swing was too small */
+	U16 lo, mid, hi;
+};
+
+extern struct measure meas;
+
+void meas_frame(void);
+U32 meas_cross(U16 a, U16 b, U16 level, U16 i);
+U32 meas_time_ns(U32 t);
+U32 meas_freq_mhz(void);
+
+#endif
@@ -0,0 +1,63 @@
+#include "stm32f10x.h"
+
+#include "peak.h"
+#include "scope.h"
+#include "Common.h"
+
+struct peak peak;
+
+extern struct waveform wave;
+extern struct scope dso_scope;
+
+/* Called before DMA is started on sub_buf */
+void peak_start(U16 decim)
+{
+	peak.decim = decim;
+	peak.pos = 0;
+	peak.half = 0;
+}
+
+/* DMA filled one half of sub_buf, reduce it to the next pixel */
+void peak_reduce(void)
+{
+	__IO U16 *p = peak.sub_buf + (peak.half ? peak.decim : 0);
+	U16 i, val, max, min;
+	U32 sum;
+
+	if(dso_scope.acq_mode == ACQ_HIRES) {
+		sum = 0;
+		for(i = 0; i < peak.decim; ++i)
+			sum += p[i];
+		wave.peak_buf[peak.pos] = ((sum << HIRES_SHIFT) + peak.decim / 2) / peak.decim;
+	} else {
+		max = min = p[0];
+		for(i = 1; i < peak.decim; ++i) {
+			val = p[i];
+			if(val > max)
+				max = val;
+			else if(val < min)
+				min = val;
+		}
+		wave.peak_buf[peak.pos] = PEAK_PACK(max, min);
+	}
+
+	if(++peak.pos >= wave.ring_len)
+		peak.pos = 0;
+	peak.half ^= 1;
+}
+
+/*
+ * Frame ring index of the pixel the last converted sample belongs to.
+ * [cndtr] is the DMA counter, the sample may already have been reduced
+ * if its half was completed by it.
+ */
+U16 peak_index(U16 cndtr)
+{
+	U16 next = 2 * peak.decim - cndtr;
+	U8 half = (next ? next - 1 : 2 * peak.decim - 1) >= peak.decim;
+
+	if(half == peak.half)
+		return peak.pos;
+
+	return peak.pos ? peak.pos - 1 : wave.ring_len - 1;
+}
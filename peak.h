@@ -0,0 +1,46 @@
+#ifndef PEAK_H
+#define PEAK_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * Peak detect and hi-res acquisition for the slow timebases.
+ *
+ * ADC1 runs at PEAK_CLKS per sample into a small DMA ring of two halves,
+ * each half holds the samples of one pixel. The half/transfer complete
+ * interrupt reduces a half and stores it in the frame ring (wave.peak_buf):
+ *	ACQ_PEAK  - min/max pair, a glitch between two pixels can't be missed
+ *	ACQ_HIRES - boxcar mean with HIRES_SHIFT fraction bits, averaging
+ *	            N samples of noise gives about log4(N) extra bits
+ */
+#define PEAK_CLKS		96	/* ~750kHz, close to the single ADC limit */
+#define PEAK_DECIM_MIN		4	/* Below this the normal mode is as good */
+#define PEAK_DECIM_MAX		128	/* Samples per pixel */
+
+/* Samples per pixel for a timebase, 0 if peak detect is not worth it */
+#define PEAK_DECIM(pres)	((pres) / PEAK_CLKS < PEAK_DECIM_MIN ? 0 : \
+					((pres) / PEAK_CLKS > PEAK_DECIM_MAX ? PEAK_DECIM_MAX : \
+					(pres) / PEAK_CLKS))
+
+/* Hi-res samples are ADC values << HIRES_SHIFT, 16 bits in total */
+#define HIRES_SHIFT		4
+
+/* Frame ring entry */
+#define PEAK_PACK(max, min)	(((U32)(max) << 16) | (min))
+#define PEAK_MAX(w)		((U16)((w) >> 16))
+#define PEAK_MIN(w)		((U16)((w) & 0xFFFF))
+
+struct peak {
+	__IO U16 sub_buf[2 * PEAK_DECIM_MAX];	/* DMA ring, two pixels */
+	U16 decim;				/* Samples per pixel */
+	__IO U16 pos;				/* Frame ring index of the next pixel */
+	__IO U8 half;				/* sub_buf half reduced next */
+};
+
+void peak_start(U16 decim);
+void peak_reduce(void);
+U16 peak_index(U16 cndtr);
+
+#endif
@@ -0,0 +1,111 @@
+#include "stm32f10x.h"
+
+#include "persist.h"
+#include "render.h"
+#include "Screen.h"
+#include "Common.h"
+#include "string.h"
+
+struct persist persist;
+
+/* Cell colour by hit count, 0 shows what is under it */
+const U16 persist_ramp[PERSIST_LEVELS] = { BG_CL, clNavy, clDeepskyblue, clAqua };
+
+#define CELL(c, r)		((U16)(c) * PERSIST_ROWS + (r))
+#define CELL_SHIFT(i)		(((i) & 15) * 2)
+
+/* Turn the persistence display on or off, either way it starts empty */
+void persist_config(U8 on)
+{
+	if(persist.on == on)
+		return;
+
+	persist.on = on;
+	persist_reset();
+}
+
+/* Drop all hits, e.g. after the timebase or trigger position changed */
+void persist_reset(void)
+{
+	memset(persist.cells, 0, sizeof(persist.cells));
+	persist.pending = 0;
+	persist.frames = 0;
+	persist.lit_top = RENDER_BOTTOM;
+	persist.lit_bottom = RENDER_TOP;
+	render_invalidate();
+}
+
+/* A new frame was taken, the next render_frame() adds its hits */
+void persist_frame(void)
+{
+	if(persist.on)
+		persist.pending = 1;
+}
+
+/* Count the pending frame, every PERSIST_DECAY frames drop all counters by
+ * one and return the rows that need repainting */
+U8 persist_decay(U8 *y0, U8 *y1)
+{
+	U32 w, any = 0;
+	U16 i;
+
+	if(++persist.frames < PERSIST_DECAY)
+		return 0;
+	persist.frames = 0;
+
+	if(persist.lit_top > persist.lit_bottom)
+		return 0;
+
+	/* Each 2-bit field loses one if any of its bits is set, no borrows */
+	for(i = 0; i < PERSIST_WORDS; ++i) {
+		w = persist.cells[i];
+		w -= (w | (w >> 1)) & 0x55555555;
+		persist.cells[i] = w;
+		any |= w;
+	}
+
+	*y0 = persist.lit_top;
+	*y1 = persist.lit_bottom;
+	if(!any) {
+		persist.lit_top = RENDER_BOTTOM;
+		persist.lit_bottom = RENDER_TOP;
+	}
+	return 1;
+}
+
+/* Add a hit to the cells of column [c] rows [top, bottom], return the rows
+ * of the cells whose count changed */
+U8 persist_hit(U16 c, U8 top, U8 bottom, U8 *y0, U8 *y1)
+{
+	U16 r, i;
+	U8 changed = 0;
+
+	r = (top - RENDER_TOP) / PERSIST_ROW_PX;
+	for(; r <= (bottom - RENDER_TOP) / PERSIST_ROW_PX; ++r) {
+		i = CELL(c, r);
+		if(((persist.cells[i >> 4] >> CELL_SHIFT(i)) & 3) == PERSIST_MAX)
+			continue;
+		persist.cells[i >> 4] += 1 << CELL_SHIFT(i);
+
+		if(!changed)
+			*y0 = RENDER_TOP + r * PERSIST_ROW_PX;
+		*y1 = RENDER_TOP + r * PERSIST_ROW_PX + PERSIST_ROW_PX - 1;
+		changed = 1;
+	}
+
+	if(changed) {
+		if(*y0 < persist.lit_top)
+			persist.lit_top = *y0;
+		if(*y1 > persist.lit_bottom)
+			persist.lit_bottom = *y1;
+	}
+	return changed;
+}
+
+/* Hit count under screen row [y] of column [c] */
+U8 persist_level(U16 c, U8 y)
+{
+	U16 i = CELL(c, (y - RENDER_TOP) / PERSIST_ROW_PX);
+
+	return (persist.cells[i >> 4] >> CELL_SHIFT(i)) & 3;
+}
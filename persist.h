@@ -0,0 +1,45 @@
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+#include "render.h"
+
+/*
+ * Persistence display: how often the trace took a path.
+ *
+ * Every new frame bumps a saturating 2-bit hit counter in each cell its
+ * spans cover, every PERSIST_DECAY frames all counters drop by one. The
+ * renderer paints the counts under the live trace through a colour ramp,
+ * so paths the trace takes now and then stay visible dimmed.
+ *
+ * A cell is one column by PERSIST_ROW_PX rows, 16 cells per word, all of
+ * the wave display fits 3.7K of RAM.
+ */
+#define PERSIST_ROW_PX		4
+#define PERSIST_ROWS		(WD_HEIGHT / PERSIST_ROW_PX)
+#define PERSIST_WORDS		((RENDER_COLS * PERSIST_ROWS + 15) / 16)
+#define PERSIST_LEVELS		4
+#define PERSIST_MAX		(PERSIST_LEVELS - 1)
+#define PERSIST_DECAY		8		/* Frames per decay step */
+
+struct persist {
+	U32 cells[PERSIST_WORDS];	/* Column major, 2 bits per cell */
+	U8 on;
+	U8 pending;			/* A new frame waits for render_frame() */
+	U8 frames;			/* New frames since the last decay */
+	U8 lit_top, lit_bottom;		/* Screen rows that may hold hits, top > bottom if none */
+};
+
+extern struct persist persist;
+extern const U16 persist_ramp[PERSIST_LEVELS];
+
+void persist_config(U8 on);
+void persist_reset(void);
+void persist_frame(void);
+U8 persist_decay(U8 *y0, U8 *y1);
+U8 persist_hit(U16 c, U8 top, U8 bottom, U8 *y0, U8 *y1);
+U8 persist_level(U16 c, U8 y);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+
+/*
+ * USART1 framing, shared by the firmware and Linux_serial.
+ *
+ * Frame: PROTO_SYNC, payload length (16 bits), type, sequence number, the
+ * payload and a CRC16. Multi-byte fields are little endian, the CRC is
+ * CRC-16/CCITT-FALSE over everything after the sync byte.
+ *
+ * Every host command is answered with a frame of its sequence number:
+ * PROTO_ACK, PROTO_NAK with a PROTO_ERR_* payload byte or, for
+ * PROTO_SEND_WF and PROTO_SEND_STATS, PROTO_WAVEFORM and PROTO_STATS.
+ * The device answers each command before it parses the next, so the
+ * answers come in command order. The host may have PROTO_WINDOW commands
+ * unanswered, the device RX ring holds them, and sends a command again on
+ * a PROTO_ERR_CRC NAK or when its answer times out. The device
+ * acknowledges a command it already ran without running it again, so a
+ * lost ACK doesn't repeat a button press. The host starts with
+ * PROTO_RESET.
+ */
+#define PROTO_SYNC		0xA5
+#define PROTO_HDR_LEN		5	/* Sync, length, type, sequence */
+#define PROTO_CRC_LEN		2
+#define PROTO_CRC_INIT		0xFFFF
+#define PROTO_CMD_MAX		8	/* Longest command payload the device takes */
+#define PROTO_WINDOW		8	/* Unanswered commands, fit the device RX ring */
+
+/* Host commands */
+#define PROTO_SEL		0x04
+#define PROTO_PLUS		0x05
+#define PROTO_MINUS		0x06
+#define PROTO_SINGLE		0x07
+#define PROTO_SEND_WF		0x08
+#define PROTO_RESET		0x09	/* New session, forget the sequence numbers */
+#define PROTO_SEND_STATS	0x0A	/* Main loop and task loads */
+
+/* Device answers */
+#define PROTO_ACK		0x81
+#define PROTO_NAK		0x82
+#define PROTO_WAVEFORM		0x83	/* Timebase us/div (16 bits), then the samples */
+#define PROTO_STATS		0x84	/* fps, idle %, task count, then the tasks */
+
+#define PROTO_WF_SAMPLES	300
+#define PROTO_WF_LEN		(2 + 2 * PROTO_WF_SAMPLES)
+
+/* Per task in the scheduler order: load % of the last second, frames
+ * skipped (16 bits) and the longest run in CPU cycles (32 bits) */
+#define PROTO_STATS_TASK_LEN	7
+#define PROTO_STATS_LEN(tasks)	(3 + PROTO_STATS_TASK_LEN * (tasks))
+
+/* PROTO_NAK reasons */
+#define PROTO_ERR_CRC		0x01
+#define PROTO_ERR_TYPE		0x02
+#define PROTO_ERR_LEN		0x03
+#define PROTO_ERR_NO_WF		0x04	/* No single shot capture to send */
+
+/* CRC-16/CCITT-FALSE, one byte at a time */
+static inline uint16_t proto_crc16(uint16_t crc, uint8_t b)
+{
+	uint8_t i;
+
+	crc ^= (uint16_t)b << 8;
+	for(i = 0; i < 8; ++i)
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	return crc;
+}
+
+#endif
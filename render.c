@@ -0,0 +1,358 @@
+#include "stm32f10x.h"
+
+#include "render.h"
+#include "persist.h"
+#include "fft.h"
+#include "scope.h"
+#include "Screen.h"
+#include "Common.h"
+#include "string.h"
+
+struct render render;
+
+extern struct waveform wave;
+
+/* The wave display was cleared or drawn over, start from an empty grid */
+void render_invalidate(void)
+{
+	render.valid = 0;
+}
+
+/* Mark screen rect [x, x + w) x [y, y + h) for repainting, clipped to the wave display */
+static void render_dirty(S16 x, S16 y, S16 w, S16 h)
+{
+	struct render_rect *r;
+	S16 x1 = x + w - 1, y1 = y + h - 1;
+
+	if(x < WD_OFFSETX)
+		x = WD_OFFSETX;
+	if(x1 > WD_OFFSETX + RENDER_COLS - 1)
+		x1 = WD_OFFSETX + RENDER_COLS - 1;
+	if(y < RENDER_TOP)
+		y = RENDER_TOP;
+	if(y1 > RENDER_BOTTOM)
+		y1 = RENDER_BOTTOM;
+	if(x > x1 || y > y1)
+		return;
+
+	/* Out of rects, repaint everything instead */
+	if(render.dirty_nr == RENDER_DIRTY) {
+		render.dirty_nr = 1;
+		x = WD_OFFSETX;
+		x1 = WD_OFFSETX + RENDER_COLS - 1;
+		y = RENDER_TOP;
+		y1 = RENDER_BOTTOM;
+	}
+
+	r = &render.dirty[render.dirty_nr++];
+	r->x0 = x;
+	r->x1 = x1;
+	r->y0 = y;
+	r->y1 = y1;
+}
+
+/* Compose rows [y0, y1] of column [c] in the line buffer and send them */
+static void render_strip(U16 c, U8 y0, U8 y1)
+{
+	U16 x = WD_OFFSETX + c, cl, run, n = y1 - y0 + 1;
+	U16 *line = render.line;
+	U8 y, top, bottom, col, bits, lvl;
+	const U8 *glyph;
+	struct render_text *t;
+
+	/* Grid, horizontal lines win at the crossings as grid_display() draws them */
+	cl = BG_CL;
+	if(!(c % GRID_DIST))
+		cl = (c == (WD_WIDTH / GRID_DIST / 2) * GRID_DIST) ? GRID_CENTER_CL : GRID_CL;
+	for(y = 0; y < n; ++y)
+		line[y] = cl;
+	y = RENDER_TOP + (y0 - RENDER_TOP + GRID_DIST - 1) / GRID_DIST * GRID_DIST;
+	for(; y <= y1; y += GRID_DIST)
+		line[y - y0] = (y == WD_MIDY) ? GRID_CENTER_CL : GRID_CL;
+
+	/* Persistence hits */
+	if(persist.on)
+		for(y = y0; y <= y1; ++y) {
+			lvl = persist_level(c, y);
+			if(lvl)
+				line[y - y0] = persist_ramp[lvl];
+		}
+
+	/* Trace */
+	top = (render.top[c] > y0) ? render.top[c] : y0;
+	bottom = (render.bottom[c] < y1) ? render.bottom[c] : y1;
+	for(y = top; y <= bottom && top <= bottom; ++y)
+		line[y - y0] = WF_CL;
+
+	/* Time-voltage cursor */
+	if(render.tvc_x == x) {
+		for(y = 0; y < n; ++y)
+			line[y] = TVC_CL;
+	} else if(render.tvc_x != RENDER_OFF && render.tvc_y >= y0 && render.tvc_y <= y1)
+		line[render.tvc_y - y0] = TVC_CL;
+
+	/* Text, opaque like PutsGenic() */
+	for(t = render.texts; t < render.texts + RENDER_TEXTS; ++t) {
+		if(!t->len || x < t->x || x >= t->x + t->len * ASC8X16.CharPitch)
+			continue;
+		col = x - t->x;
+		bits = 0x80 >> (col % ASC8X16.CharPitch);
+		glyph = ASC8X16.Array + (t->text[col / ASC8X16.CharPitch] - ASC8X16.IndexOfs) * ASC8X16.Ysize;
+		top = (t->y > y0) ? t->y : y0;
+		bottom = (t->y + ASC8X16.Ysize - 1 < y1) ? t->y + ASC8X16.Ysize - 1 : y1;
+		for(y = top; y <= bottom && top <= bottom; ++y)
+			line[y - y0] = (glyph[y - t->y] & bits) ? t->fg : t->bg;
+	}
+
+	/* One window, colour runs */
+	VSpanBegin(x, y0, n);
+	cl = line[0];
+	run = 0;
+	for(y = 0; y < n; ++y) {
+		if(line[y] != cl) {
+			VSpanPut(cl, run);
+			cl = line[y];
+			run = 0;
+		}
+		++run;
+	}
+	VSpanPut(cl, run);
+	VSpanEnd();
+}
+
+/* Rows of column [c] under dirty rects, 0 if none */
+static U8 render_dirty_rows(U16 c, U8 *y0, U8 *y1)
+{
+	struct render_rect *r;
+	U16 x = WD_OFFSETX + c;
+	U8 hit = 0;
+
+	for(r = render.dirty; r < render.dirty + render.dirty_nr; ++r) {
+		if(x < r->x0 || x > r->x1)
+			continue;
+		if(!hit || r->y0 < *y0)
+			*y0 = r->y0;
+		if(!hit || r->y1 > *y1)
+			*y1 = r->y1;
+		hit = 1;
+	}
+	return hit;
+}
+
+/* Move column [c] from its old span to [top, bottom] */
+static void render_column(U16 c, U8 top, U8 bottom)
+{
+	U8 ot = render.top[c], ob = render.bottom[c];
+	U8 y0 = RENDER_BOTTOM, y1 = RENDER_TOP, py0, py1, dirty;
+
+	render.top[c] = top;
+	render.bottom[c] = bottom;
+
+	dirty = render_dirty_rows(c, &y0, &y1);
+	if(persist.pending && persist_hit(c, top, bottom, &py0, &py1)) {
+		if(!dirty || py0 < y0)
+			y0 = py0;
+		if(!dirty || py1 > y1)
+			y1 = py1;
+		dirty = 1;
+	}
+
+	/* Under an overlay or persistence change: one strip over all of it */
+	if(dirty) {
+		if(ot <= ob) {
+			if(ot < y0)
+				y0 = ot;
+			if(ob > y1)
+				y1 = ob;
+		}
+		if(top < y0)
+			y0 = top;
+		if(bottom > y1)
+			y1 = bottom;
+		render_strip(c, y0, y1);
+		return;
+	}
+
+	if(ot > ob || bottom < ot || top > ob) {
+		/* Disjoint, nothing to keep */
+		if(ot <= ob)
+			render_strip(c, ot, ob);
+		render_strip(c, top, bottom);
+	} else {
+		/* Only the ends moved */
+		if(top < ot)
+			render_strip(c, top, ot - 1);
+		else if(top > ot)
+			render_strip(c, ot, top - 1);
+		if(bottom > ob)
+			render_strip(c, ob + 1, bottom);
+		else if(bottom < ob)
+			render_strip(c, bottom + 1, ob);
+	}
+}
+
+/* Screen y of an ADC value on the display, kept inside the wave display */
+static U8 render_y(S16 y)
+{
+	if(y < RENDER_TOP)
+		return RENDER_TOP;
+	if(y > RENDER_BOTTOM)
+		return RENDER_BOTTOM;
+	return y;
+}
+
+/*
+ * Span the 2 pixel wide rect of sample [i] covers, the same shapes the
+ * rect per sample drawing had: a segment from the previous sample, or a
+ * dot when the jump is bigger than half the display. Peak detect frames
+ * draw the min/max bar joined to the previous pixel.
+ */
+static void render_span(U16 i, S16 *top, S16 *bottom)
+{
+	U16 mid = wave.midpoint;
+	U16 hi, lo;
+	S16 cur, prev, diff;
+
+	if(wave.display_peak) {
+		hi = wave.display_buf[i];
+		lo = wave.display_min[i];
+		if(i) {
+			if(wave.display_min[i - 1] > hi)
+				hi = wave.display_min[i - 1];
+			if(wave.display_buf[i - 1] < lo)
+				lo = wave.display_buf[i - 1];
+		}
+		*top = mid - GET_SAMPLE(hi);
+		*bottom = mid - GET_SAMPLE(lo) + 1;
+		return;
+	}
+
+	cur = mid - GET_SAMPLE(FRAME_ADC(wave.display_buf[i]));
+	prev = i ? mid - GET_SAMPLE(FRAME_ADC(wave.display_buf[i - 1])) : cur;
+	diff = prev - cur;
+
+	if(diff > 1 && diff <= WD_HEIGHT / 2) {
+		*top = cur;
+		*bottom = prev + 1;
+	} else if(diff < -1 && diff >= -(WD_HEIGHT / 2)) {
+		*top = prev;
+		*bottom = cur + 1;
+	} else {
+		*top = cur;
+		*bottom = cur + 1;
+	}
+}
+
+/* Draw the front buffer, touching only the pixels that changed */
+void render_frame(void)
+{
+	S16 top, bottom, ctop, cbottom;
+	S16 prev_top = 0x7FFF, prev_bottom = -1;
+	U16 c;
+	U8 y0, y1;
+
+	/* Nothing on screen can be kept, every column repaints in full */
+	if(!render.valid) {
+		for(c = 0; c < RENDER_COLS; ++c) {
+			render.top[c] = RENDER_BOTTOM;
+			render.bottom[c] = RENDER_TOP;
+		}
+		render.dirty_nr = 0;
+		render_dirty(WD_OFFSETX, WD_OFFSETY, WD_WIDTH, WD_HEIGHT);
+		render.valid = 1;
+	}
+
+	/* Faded persistence cells repaint with the hits of the new frame */
+	if(persist.pending && persist_decay(&y0, &y1))
+		render_dirty(WD_OFFSETX, y0, WD_WIDTH, y1 - y0 + 1);
+
+	/* Column c shows sample c and the right half of sample c - 1, or a
+	 * spectrum bar */
+	for(c = 0; c < RENDER_COLS; ++c) {
+		if(fft.on) {
+			render_column(c, fft_top(c), RENDER_BOTTOM);
+			continue;
+		}
+		if(c < SAMPLES_NR) {
+			render_span(c, &top, &bottom);
+			ctop = (prev_top < top) ? prev_top : top;
+			cbottom = (prev_bottom > bottom) ? prev_bottom : bottom;
+		} else {
+			ctop = prev_top;
+			cbottom = prev_bottom;
+		}
+		render_column(c, render_y(ctop), render_y(cbottom));
+
+		prev_top = top;
+		prev_bottom = bottom;
+	}
+	render.dirty_nr = 0;
+	persist.pending = 0;
+}
+
+/* Grid and overlays without a trace, e.g. while SINGLE waits for a trigger */
+void render_blank(void)
+{
+	U16 c;
+
+	for(c = 0; c < RENDER_COLS; ++c) {
+		render.top[c] = RENDER_BOTTOM;
+		render.bottom[c] = RENDER_TOP;
+		render_strip(c, RENDER_TOP, RENDER_BOTTOM);
+	}
+	render.dirty_nr = 0;
+	render.valid = 1;
+}
+
+/* Move the time-voltage cursor lines to screen (x, y), RENDER_OFF hides them.
+ * Shows with the next render_frame(). */
+void render_tvc(U16 x, U16 y)
+{
+	if(x == render.tvc_x && y == render.tvc_y)
+		return;
+
+	if(render.tvc_x != RENDER_OFF) {
+		render_dirty(render.tvc_x, WD_OFFSETY, 1, WD_HEIGHT);
+		render_dirty(WD_OFFSETX, render.tvc_y, WD_WIDTH, 1);
+	}
+	render.tvc_x = x;
+	render.tvc_y = y;
+	if(x != RENDER_OFF) {
+		render_dirty(x, WD_OFFSETY, 1, WD_HEIGHT);
+		render_dirty(WD_OFFSETX, y, WD_WIDTH, 1);
+	}
+}
+
+/* Put text [id] at screen (x, y) over the wave display, NULL hides it.
+ * Shows with the next render_frame(). */
+void render_text(U8 id, U16 x, U16 y, U8 *str, U16 fgcolor, U16 bgcolor)
+{
+	struct render_text *t = &render.texts[id];
+	U8 len = str ? strlen((char *)str) : 0;
+
+	if(len > LABEL_LEN)
+		len = LABEL_LEN;
+	if(len == t->len && x == t->x && y == t->y && fgcolor == t->fg && bgcolor == t->bg
+			&& (!len || !memcmp(t->text, str, len)))
+		return;
+
+	if(t->len)
+		render_dirty(t->x, t->y, t->len * ASC8X16.CharPitch, ASC8X16.Ysize);
+	t->x = x;
+	t->y = y;
+	t->fg = fgcolor;
+	t->bg = bgcolor;
+	t->len = len;
+	if(len) {
+		memcpy(t->text, str, len);
+		render_dirty(x, y, len * ASC8X16.CharPitch, ASC8X16.Ysize);
+	}
+}
+
+/* Drop the cursor lines and their text, the display mode stays */
+void render_overlays_off(void)
+{
+	render_tvc(RENDER_OFF, 0);
+	render_text(RENDER_TEXT_VOLTAGE, 0, 0, NULL, 0, 0);
+	render_text(RENDER_TEXT_TIME, 0, 0, NULL, 0, 0);
+}
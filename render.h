@@ -0,0 +1,70 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+#include "Screen.h"
+
+/*
+ * Column-diff waveform renderer and compositor.
+ *
+ * The trace covers one vertical span per screen column. The spans of the
+ * frame on screen are kept, so a new frame only repaints the pixels that
+ * left a span and the ones that were added. A frame that changed little
+ * costs a few pixels per column instead of a window clear, a grid redraw
+ * and a rect per sample.
+ *
+ * Every repainted strip of a column is composed in a line buffer first:
+ * grid, trace, time-voltage cursor and the text on top of them, then it
+ * goes to the panel once as colour runs. The persistence display, when
+ * on, is composed between the grid and the trace. Nothing in the wave
+ * display is drawn over something else, so there is no flicker. Overlay
+ * changes mark a dirty rect, the columns under it repaint the rows it
+ * covers.
+ */
+#define RENDER_COLS		WD_WIDTH		/* SAMPLES_NR samples, 2 pixels wide */
+#define RENDER_TOP		WD_OFFSETY
+#define RENDER_BOTTOM		(WD_OFFSETY + WD_HEIGHT - 1)
+#define RENDER_DIRTY		4			/* Dirty rects per frame, more repaint all */
+#define RENDER_OFF		0			/* Time-voltage cursor hidden, not a wave display column */
+
+/* Text over the wave display */
+enum render_text_id {
+	RENDER_TEXT_VOLTAGE,
+	RENDER_TEXT_TIME,
+	RENDER_TEXT_MODE,		/* Display mode, see disp_display() */
+	RENDER_TEXTS
+};
+
+struct render_text {
+	U16 x, y;
+	U16 fg, bg;
+	U8 len;				/* 0 if hidden */
+	U8 text[LABEL_LEN + 1];
+};
+
+struct render_rect {
+	U16 x0, x1;			/* Screen columns, inclusive */
+	U8 y0, y1;			/* Screen rows, inclusive */
+};
+
+struct render {
+	U8 top[RENDER_COLS];		/* Span on screen, top > bottom if empty */
+	U8 bottom[RENDER_COLS];
+	U8 valid;			/* Spans match the screen */
+	U16 line[WD_HEIGHT];		/* Colours of the strip being composed */
+	U16 tvc_x, tvc_y;		/* Time-voltage cursor, screen coordinates */
+	struct render_text texts[RENDER_TEXTS];
+	struct render_rect dirty[RENDER_DIRTY];
+	U8 dirty_nr;
+};
+
+void render_invalidate(void);
+void render_frame(void);
+void render_blank(void);
+void render_tvc(U16 x, U16 y);
+void render_text(U8 id, U16 x, U16 y, U8 *str, U16 fgcolor, U16 bgcolor);
+void render_overlays_off(void);
+
+#endif
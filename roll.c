@@ -0,0 +1,173 @@
+#include "stm32f10x.h"
+
+#include "roll.h"
+#include "scope.h"
+#include "peak.h"
+#include "Screen.h"
+#include "render.h"
+#include "Common.h"
+
+struct roll roll;
+
+extern struct waveform wave;
+extern struct scope dso_scope;
+extern struct peak peak;
+
+/* Start streaming, the capture chain must be stopped */
+void roll_start(void)
+{
+	acq_start();
+
+	roll.tail = 0;
+	roll.filled = 0;
+	roll.ofs = 0;
+	roll.col = 0;
+	roll.prev_max = roll.prev_min = ADC_MAX / 2;
+
+	scroll_set(0);
+	clr_blk(WD_OFFSETX, WD_OFFSETY, WD_WIDTH, WD_HEIGHT);
+	grid_display();
+	render_invalidate();
+
+	dso_scope.rolling = 1;
+	dso_scope.done_sampling = 1;
+}
+
+/* Called from sampling_stop(), puts the screen back in place */
+void roll_stop(void)
+{
+	if(!dso_scope.rolling)
+		return;
+
+	dso_scope.rolling = 0;
+	scroll_set(0);
+	clr_screen();
+	grid_display();
+	render_invalidate();
+	info_redraw();
+}
+
+/* Ring index DMA or peak_reduce() writes next */
+static U16 roll_head(void)
+{
+	U16 next;
+
+	if(ACQ_DECIMATED(dso_scope.acq_mode))
+		return peak.pos;
+
+	next = wave.ring_len - DMA_GetCurrDataCounter(DMA1_Channel1);
+	return (next >= wave.ring_len) ? 0 : next;
+}
+
+/* Screen y of an ADC value, kept inside the wave display */
+static U16 roll_y(U16 val)
+{
+	S16 y = wave.midpoint - GET_SAMPLE(val);
+
+	if(y < WD_OFFSETY)
+		return WD_OFFSETY;
+	if(y > WD_OFFSETY + WD_HEIGHT - 2)
+		return WD_OFFSETY + WD_HEIGHT - 2;
+	return y;
+}
+
+/* Max and min of ring entry [i] in ADC units */
+static void roll_sample(U16 i, U16 *max, U16 *min)
+{
+	U32 w;
+
+	switch(dso_scope.acq_mode) {
+	case ACQ_PEAK:
+		w = wave.peak_buf[i];
+		*max = PEAK_MAX(w);
+		*min = PEAK_MIN(w);
+		break;
+	case ACQ_HIRES:
+		*max = *min = wave.peak_buf[i] >> HIRES_SHIFT;
+		break;
+	default:
+		*max = *min = wave.tmp_buf[i];
+		break;
+	}
+}
+
+/* Draw ring entry [i] with the grid behind it at screen column [x], one span */
+static void roll_column(U16 x, U16 i)
+{
+	U16 max, min, top, bottom, y, cl, run_cl = BG_CL, run = 0;
+
+	roll_sample(i, &max, &min);
+
+	/* Join the span to the previous column so steep edges stay connected */
+	top = roll_y((max > roll.prev_min) ? max : roll.prev_min);
+	bottom = roll_y((min < roll.prev_max) ? min : roll.prev_max) + 1;
+	roll.prev_max = max;
+	roll.prev_min = min;
+
+	VSpanBegin(x, WD_OFFSETY, WD_HEIGHT);
+	for(y = WD_OFFSETY; y < WD_OFFSETY + WD_HEIGHT; ++y) {
+		if(y >= top && y <= bottom)
+			cl = WF_CL;
+		else if(!roll.col || !((y - WD_OFFSETY) % GRID_DIST))
+			cl = (y == WD_MIDY) ? GRID_CENTER_CL : GRID_CL;
+		else
+			cl = BG_CL;
+
+		/* Stream it in runs of one color */
+		if(cl != run_cl && run) {
+			VSpanPut(run_cl, run);
+			run = 0;
+		}
+		run_cl = cl;
+		++run;
+	}
+	VSpanPut(run_cl, run);
+	VSpanEnd();
+
+	if(++roll.col >= GRID_DIST)
+		roll.col = 0;
+}
+
+/* Scroll in and draw the ring entries sampled since the last call, 0 if none */
+U8 roll_update(void)
+{
+	U16 head = roll_head();
+	U16 n, i, x, max, min;
+
+	n = (head >= roll.tail) ? head - roll.tail : head + wave.ring_len - roll.tail;
+	if(!n)
+		return 0;
+
+	roll.ofs += n;
+	if(roll.ofs >= SCROLL_VSA)
+		roll.ofs -= SCROLL_VSA;
+	scroll_set(roll.ofs);
+
+	for(x = WD_OFFSETX + WD_WIDTH - n; x < WD_OFFSETX + WD_WIDTH; ++x) {
+		roll_column(x, roll.tail);
+		if(++roll.tail >= wave.ring_len)
+			roll.tail = 0;
+	}
+
+	if(roll.filled < wave.ring_len)
+		roll.filled = (roll.filled + n < wave.ring_len) ? roll.filled + n : wave.ring_len;
+
+	/* The info bars scrolled along with the trace */
+	clr_blk(WD_OFFSETX, 0, WD_WIDTH, WD_OFFSETY);
+	clr_blk(WD_OFFSETX, WD_OFFSETY + WD_HEIGHT + 1, WD_WIDTH, ScreenYsize - WD_OFFSETY - WD_HEIGHT - 1);
+	info_redraw();
+
+	/* Measurements over the samples on screen */
+	wave.max = 0;
+	wave.min = ADC_MAX;
+	i = roll.tail;
+	for(n = roll.filled; n; --n) {
+		i = i ? i - 1 : wave.ring_len - 1;
+		roll_sample(i, &max, &min);
+		if(max > wave.max)
+			wave.max = max;
+		if(min < wave.min)
+			wave.min = min;
+	}
+	return 1;
+}
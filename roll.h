@@ -0,0 +1,36 @@
+#ifndef ROLL_H
+#define ROLL_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * Roll mode for the slow timebases.
+ *
+ * The ring is sampled continuously without a trigger. Every main loop pass
+ * the display is scrolled by the number of new ring entries with the ILI9341
+ * vertical scroll (screen columns in landscape, see SCROLL_TFA) and only the
+ * new columns are drawn at the right edge. The scroll area spans the whole
+ * screen height, so the info bars move too and are redrawn after a scroll.
+ */
+#define ROLL_TB_MIN		50000	/* us/div, slowest trigger-free timebases */
+
+/* Roll instead of a triggered capture */
+#define ROLL_MODE()		(dso_scope.timebase >= ROLL_TB_MIN && \
+					!BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT)))
+
+struct roll {
+	U16 tail;		/* Ring index of the next entry to draw */
+	U16 filled;		/* Valid ring entries, for the measurements */
+	U16 ofs;		/* Hardware scroll offset, columns */
+	U16 col;		/* Columns drawn, places the vertical grid lines */
+	U16 prev_max;		/* Last drawn column, joins the trace */
+	U16 prev_min;
+};
+
+void roll_start(void);
+void roll_stop(void);
+U8 roll_update(void);
+
+#endif
@@ -0,0 +1,127 @@
+#include "stm32f10x.h"
+
+#include "sched.h"
+#include "loop.h"
+#include "Common.h"
+
+struct sched sched;
+
+extern struct loop loop;
+
+/* Cycles of one stats period in percent */
+#define SCHED_PERCENT		((SystemCoreClock / 1000) * (LOOP_STATS_MS / 100))
+
+void sched_config(void)
+{
+	U8 i;
+
+	for(i = 0; i < TASKS_NR; ++i) {
+		sched.tasks[i].run = 0;
+		sched.tasks[i].ready = 0;
+	}
+	sched.period = loop.period;
+	sched.skips_due = 0;
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT_CYCCNT = 0;
+	DWT_CTRL |= (1 << DWT_CYCCNTENA);
+	sched.frame_start = DWT_CYCCNT;
+}
+
+void sched_add(U8 id, void (*run)(void), U8 skip_max)
+{
+	struct task *t = &sched.tasks[id];
+
+	t->run = run;
+	t->ready = 0;
+	t->skip_max = skip_max;
+	t->skip = 0;
+	t->skipped = 0;
+	t->load = 0;
+	t->cycles = 0;
+	t->max = 0;
+	t->skips = 0;
+}
+
+void sched_ready(U8 id)
+{
+	sched.tasks[id].ready = 1;
+}
+
+/* The frame budget starts */
+void sched_frame(void)
+{
+	U8 i;
+
+	for(i = 0; i < TASKS_NR; ++i)
+		sched.tasks[i].skip = 0;
+	sched.skips_due = 1;
+	sched.frame_start = DWT_CYCCNT;
+}
+
+/* Over budget, pass the ready tasks with a skip limit over for this frame */
+static void sched_skips(void)
+{
+	struct task *t;
+	U8 over = DWT_CYCCNT - sched.frame_start > SCHED_BUDGET, i;
+
+	for(i = 0; i < TASKS_NR; ++i) {
+		t = &sched.tasks[i];
+		t->skip = over && t->ready && t->skip_max && t->skipped < t->skip_max;
+		if(t->skip) {
+			t->skipped++;
+			t->skips++;
+		}
+	}
+	sched.skips_due = 0;
+}
+
+/* Loads of the period that just ended */
+static void sched_latch(void)
+{
+	U8 i;
+
+	for(i = 0; i < TASKS_NR; ++i) {
+		sched.tasks[i].load = sched.tasks[i].cycles / SCHED_PERCENT;
+		sched.tasks[i].cycles = 0;
+	}
+	sched.period = loop.period;
+}
+
+/* Run the ready tasks by priority until none is left */
+void sched_run(void)
+{
+	struct task *t;
+	U32 start, cycles;
+	U8 i;
+
+	for(;;) {
+		if(sched.period != loop.period)
+			sched_latch();
+
+		for(i = 0; i < TASKS_NR; ++i) {
+			t = &sched.tasks[i];
+			if(!t->ready)
+				continue;
+
+			/* Over budget, leave it for a later frame */
+			if(t->skip_max && sched.skips_due)
+				sched_skips();
+			if(t->skip)
+				continue;
+			break;
+		}
+		if(i == TASKS_NR)
+			return;
+
+		t->ready = 0;
+		t->skipped = 0;
+		start = DWT_CYCCNT;
+		t->run();
+		cycles = DWT_CYCCNT - start;
+
+		t->cycles += cycles;
+		if(cycles > t->max)
+			t->max = cycles;
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+#include "loop.h"
+
+/*
+ * Cooperative main loop tasks.
+ *
+ * A task runs to completion when it is ready, sched_run() always picks the
+ * ready task with the lowest id, so the enum order is the priority. Tasks
+ * make each other ready, the loop makes TASK_UI ready on every wakeup.
+ *
+ * The DWT cycle counter times every run: cycles adds up the current stats
+ * period (LOOP_STATS_MS), load is the last period in percent and max the
+ * longest run. The host reads them with PROTO_SEND_STATS.
+ *
+ * A task with a skip limit is not started once the frame, from
+ * sched_frame(), took more than SCHED_BUDGET cycles; it stays ready and
+ * is passed over in at most skip_max frames in a row. The skips are
+ * decided once a frame, when the first such task is due, so the wakeups
+ * for events later in the frame don't add to them.
+ */
+#define SCHED_BUDGET		(LOOP_FRAME_MS * (SystemCoreClock / 1000))
+#define SCHED_INFO_SKIPS	4	/* TASK_INFO skip limit */
+
+/* DWT registers, not in this CMSIS version */
+#define DWT_CTRL		(*(__IO U32 *)0xE0001000)
+#define DWT_CYCCNT		(*(__IO U32 *)0xE0001004)
+#define DWT_CYCCNTENA		0
+
+enum task_id {
+	TASK_ACQUIRE,		/* Take the captured frame, restart the capture */
+	TASK_UI,		/* Main loop events, host commands */
+	TASK_MEASURE,		/* Persistence, measurements, spectrum */
+	TASK_TRACE,		/* Wave display */
+	TASK_INFO,		/* Info bar labels */
+	TASKS_NR
+};
+
+struct task {
+	void (*run)(void);
+	U8 ready;
+	U8 skip_max;		/* 0 never skipped */
+	U8 skip;		/* Passed over for the rest of this frame */
+	U8 skipped;		/* Frames in a row */
+	U8 load;		/* Percent of the last period */
+	U32 cycles;		/* This period */
+	U32 max;		/* Longest run */
+	U16 skips;		/* Total */
+};
+
+struct sched {
+	struct task tasks[TASKS_NR];
+	U32 frame_start;	/* DWT_CYCCNT at sched_frame() */
+	U8 skips_due;		/* Skips not decided yet this frame */
+	U8 period;		/* loop.period the loads were latched at */
+};
+
+void sched_config(void);
+void sched_add(U8 id, void (*run)(void), U8 skip_max);
+void sched_ready(U8 id);
+void sched_frame(void);
+void sched_run(void);
+
+#endif
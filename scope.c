@@ -1,6 +1,19 @@
 #include "stm32f10x.h"
 
 #include "scope.h"
+#include "trigger.h"
+#include "avg.h"
+#include "persist.h"
+#include "fft.h"
+#include "peak.h"
+#include "roll.h"
+#include "freqcnt.h"
+#include "render.h"
+#include "measure.h"
+#include "btn.h"
+#include "loop.h"
+#include "sched.h"
+#include "uart.h"
 #include "Screen.h"
 #include "Board.h"
 #include "stdlib.h"
@@ -10,8 +23,23 @@
 struct scope dso_scope;
 struct waveform wave;
 
-__IO U16 timebase_vals[] = { 10, 20, 50, 100, 200, 500, 1000, 5000 };
-__IO U16 timebase_pres[] = { 116, 115, 144, 288, 576, 1440, 2880, 14524 }; /* Timer prescaler 72Mhz */
+extern struct peak peak;
+extern struct loop loop;
+extern struct sched sched;
+
+/* 1-2-5 sequence, 10us and 20us sample ADC1/ADC2 pairs as fast as they go */
+const struct timebase timebases[TIMEBASE_NR] = {
+	TIMEBASE_PAIR(10, 4),	/* Every other frame sample is a midpoint */
+	TIMEBASE_PAIR(20, 2),
+	TIMEBASE(50), TIMEBASE(100), TIMEBASE(200), TIMEBASE(500),
+	TIMEBASE(1000), TIMEBASE(2000), TIMEBASE(5000),
+	TIMEBASE(10000), TIMEBASE(20000), TIMEBASE(50000),
+	TIMEBASE(100000), TIMEBASE(200000), TIMEBASE(500000),
+	TIMEBASE(1000000), TIMEBASE(2000000), TIMEBASE(5000000),
+	TIMEBASE(10000000)
+};
+__IO U8 trig_pos_vals[] = { 10, 25, 50, 75, 90 };
+__IO U8 acq_sel_modes[] = { ACQ_SINGLE, ACQ_PEAK, ACQ_HIRES };
 
 /* Global peripheral initializers */
 __IO TIM_TimeBaseInitTypeDef TIM3_struct;
@@ -24,44 +52,59 @@ void scope_init(void)
 {
 	dso_scope.tb_i = 4;
 	dso_scope.done_sampling = 0;
-	dso_scope.done_displaying = 0;
-	dso_scope.timebase = timebase_vals[dso_scope.tb_i];
+	dso_scope.acquiring = 0;
+	dso_scope.rolling = 0;
+	dso_scope.timebase = timebases[dso_scope.tb_i].us;
+	dso_scope.tp_i = 2;
+	dso_scope.avg_i = 0;
+	dso_scope.acq_i = 0;
+	dso_scope.disp_i = DISP_WAVE;
 	
 	/* Real time mode */
 	dso_scope.rt_mode = 1;
-	dso_scope.rt_timer = (U16)12 * dso_scope.timebase;
-
-	/* Averaging function */
-	dso_scope.avg_flag = 1;
-	dso_scope.avg_total = 32;
 
 	/* Trig lvl */
 	dso_scope.trig_lvl_adc = 2000;
-	dso_scope.test_timer = dso_scope.timebase / 2;
-	dso_scope.prev_cal_samp = ADC_MAX;
 	
 	/* Buttons */
-	dso_scope.debounced = 0;
 	dso_scope.btns_flags = 0;
 	BitSet(dso_scope.btns_flags, (1 << LCURSOR_BIT));
 	BitSet(dso_scope.btns_flags, (1 << RCURSOR_BIT));
 	BitSet(dso_scope.btns_flags, (1 << TB_BIT));
+	BitSet(dso_scope.btns_flags, (1 << TP_BIT));
+	BitSet(dso_scope.btns_flags, (1 << AVG_BIT));
+	BitSet(dso_scope.btns_flags, (1 << ACQ_BIT));
+	BitSet(dso_scope.btns_flags, (1 << DISP_BIT));
 	dso_scope.btn_selected = tb;
-	
-	/* USART1 */
-	dso_scope.RX_flag = RX_WAITING;
-	dso_scope.RX_command = 0;
+	btn_config();
+
+	dso_scope.trig_auto = 0;
 }
 
 void waveform_init(void) 
 {
 	U16 i;
 	for(i = 0; i< SAMPLES_NR; ++i) {
-		wave.display_buf[i] = 0;
-		wave.avg_buf[i] = 0;
+		wave.frames[0][i] = 0;
+		wave.frames[1][i] = 0;
+		wave.frames_min[0][i] = 0;
+		wave.frames_min[1][i] = 0;
 		wave.tmp_buf[i] = 0;
 	}
 
+	wave.display_buf = wave.frames[0];
+	wave.display_min = wave.frames_min[0];
+	wave.display_peak = 0;
+	wave.display_shift = 0;
+	wave.avg_buf = wave.frames[1];
+	wave.avg_min = wave.frames_min[1];
+	wave.avg_peak = 0;
+	wave.avg_shift = 0;
+	wave.frame_ready = 0;
+
+	wave.ring_len = SAMPLES_NR;
+	wave.start = 0;
+
 	wave.midpoint = WD_MIDY;
 	wave.min = WD_HEIGHT - WD_OFFSETY;
 	wave.max = WD_OFFSETY;
@@ -69,17 +112,21 @@ void waveform_init(void)
 
 void waveform_display(void)
 {
+	if(dso_scope.rolling) {
+		if(roll_update())
+			loop_frame();
+		return;
+	}
+
 	if(BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT)))
 		if(!BitTest(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT))) 
 			return;	/* Wait for a trigger to happen. Keep the screen clear. */
 		else {
 			if(BitTest(dso_scope.btns_flags, (1 << ANALYZING_BIT))) {
 				if(tvc_update()) {
-					clr_blk(WD_OFFSETX, WD_OFFSETY, WD_WIDTH, WD_HEIGHT);
-					grid_display();
-					wf_display_only();
 					tvc_display(dso_scope.tvc_x, dso_scope.tvc_y);
 					tvc_label_display();
+					render_frame();
 				}
 				return;
 			}
@@ -87,83 +134,21 @@ void waveform_display(void)
 				BitSet(dso_scope.btns_flags, (1 << ANALYZING_BIT)); /* */
 		}
 
-	U16 prev_val, current_val;
-	U16 wave_per = 1; /* The first trigger is the one that started the samping */
-	U16 freq_cnt = 0;
-
-	double freq_avg = 0;
-
-	/* Clear current waveform in one go */
-	FillRect(WD_OFFSETX, wave.midpoint - GET_SAMPLE(wave.max) - 10, WD_WIDTH, GET_SAMPLE((wave.max - wave.min)) + 3 + 20, BG_CL);
-
-	grid_display();
-	U16 xpos = 10;
-	U16 i = 0, current_ypos = 0, prev_ypos = 0;
-	S16 diff = 0;
 	U16 midpoint = wave.midpoint;
 
-	wave.max = wave.display_buf[0];
-	wave.min = wave.display_buf[0];
-
-	/* Display first sample */
-	prev_val = wave.display_buf[i];
-	prev_ypos = GET_SAMPLE(wave.display_buf[i++]);
-	FillRect(xpos++, midpoint - prev_ypos, 2, 2, WF_CL);
-
-	/* Display the rest */
-	for(; i < SAMPLES_NR; ++i, ++xpos) {
-		current_val = wave.display_buf[i];
-		current_ypos = GET_SAMPLE(current_val);
-		
-		/* Update min and max */
-		if(current_val > wave.max)
-			wave.max = current_val;
-		else if(current_val < wave.min)
-			wave.min = current_val;	
-
-		/* Update frequency counter */
-		if(i > 25){	
-			if(!(prev_val < dso_scope.trig_lvl_adc - NOISE_MARGIN && current_val > (dso_scope.trig_lvl_adc + NOISE_MARGIN)))
-				++wave_per;
-			else {
-				if(freq_cnt >= 1)
-				{	if(freq_avg == 0)
-						freq_avg = GET_FREQ(wave_per);
-					else 
-						freq_avg = (freq_avg + GET_FREQ(wave_per)) / 2;
-				}
-				wave_per = 1;
-				++freq_cnt;
-			}
-		}
-		
-		/* Display sample accordingly */
-		diff = current_ypos - prev_ypos;
-		if(diff > 1 && diff <= WD_HEIGHT / 2 )
-			FillRect(xpos, midpoint - current_ypos, 2, 2 + diff, WF_CL);
-		else if((diff < -1 && diff >= -(WD_HEIGHT / 2)))
-			FillRect(xpos, midpoint - prev_ypos, 2, 2 - diff, WF_CL);
-		else
-			FillRect(xpos, midpoint - current_ypos, 2, 2, WF_CL);
-		/* Update */
-		prev_ypos = current_ypos;
-		prev_val = current_val;
-
-	}
-
-	/* Update frequency */
-	if(freq_cnt > 1)
-		wave.frequency = freq_avg;
-	else 
-		wave.frequency = 0;
+	/* Levels of the frame, see meas_frame() */
+	wave.max = meas.max;
+	wave.min = meas.min;
 
+	/* The captured frame comes with the time-voltage cursor */
 	if(BitTest(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT))) {
 		dso_scope.tvc_x = SAMPLES_NR / 2;
-		dso_scope.tvc_y = midpoint - GET_SAMPLE(wave.display_buf[SAMPLES_NR / 2]);
+		dso_scope.tvc_y = midpoint - GET_SAMPLE(FRAME_ADC(wave.display_buf[SAMPLES_NR / 2]));
 		tvc_display(dso_scope.tvc_x, dso_scope.tvc_y);
 		tvc_label_display();
 	}
 
+	render_frame();
 }
 
 void tvc_display(U16 tvc_x, U16 tvc_y)
@@ -172,55 +157,66 @@ void tvc_display(U16 tvc_x, U16 tvc_y)
 	if(tvc_y > WD_HEIGHT || tvc_x > WD_WIDTH)
 		return;
 
-	/* Draw horizontal line */
-	FillRect(WD_OFFSETX, tvc_y, WD_WIDTH, 1, TVC_CL);
-	
-	/* Draw vertical line */
-	FillRect(WD_OFFSETX + tvc_x, WD_OFFSETY, 1, WD_HEIGHT, TVC_CL);
+	/* Horizontal and vertical line, composed with the next frame */
+	render_tvc(WD_OFFSETX + tvc_x, tvc_y);
 }
 
 void tvc_label_display(void)
 {
-	voltage_display(TVC_LABEL_OFFSETX, TVC_LABEL_OFFSETY, (U8 *)"Voltage:", 
-				wave.display_buf[dso_scope.tvc_x], clWhite, clBlack);
+	U8 text[LABEL_LEN + 1];
+
+	voltage_str(text, (U8 *)"Voltage:", FRAME_ADC(wave.display_buf[dso_scope.tvc_x]));
+	render_text(RENDER_TEXT_VOLTAGE, TVC_LABEL_OFFSETX, TVC_LABEL_OFFSETY, text, clWhite, clBlack);
 	tvc_time_display(dso_scope.tvc_x);
 }
 	
 void tvc_time_display(U16 tvc_x)
 {
-	clr_blk(TVC_LABEL_OFFSETX, TVC_LABEL_OFFSETY + 18, 15 * CHAR_WID, 16);
-	U8 t_buf[20];
-	U8 *buf_ptr = t_buf;
+	U8 t_buf[LABEL_LEN + 1] = "Time:";
+	U8 *num = t_buf + 5;
+	U8 *buf_ptr = num;
+
+	double samp_us = tvc_x * ((double)TB_DIVS * dso_scope.timebase / SAMPLES_NR);
+	U8 unit = 'u';
+
+	/* Slow timebases don't fit the label in microseconds */
+	if(samp_us >= 10000000) {
+		samp_us /= 1000000;
+		unit = 0;
+	} else if(samp_us >= 10000) {
+		samp_us /= 1000;
+		unit = 'm';
+	}
 
-	double samp_us = tvc_x * (12.0 * (double)dso_scope.timebase / SAMPLES_NR);
-	
-	U16 int_part = samp_us;
+	U32 int_part = samp_us;
+	double frac = samp_us - int_part;
 	do {
 		*buf_ptr = (int_part % 10) + '0';
 		int_part /= 10;
 		++buf_ptr;
 	} while(int_part);
 
-	U8 size = (buf_ptr - t_buf) / sizeof(char);
+	U8 size = (buf_ptr - num) / sizeof(char);
 	for(U8 i = 0; i < size / 2; ++i) {
-		U8 tmp = t_buf[i];
-		t_buf[i] = t_buf[size - 1 - i];
-		t_buf[size - 1 - i] = tmp;
+		U8 tmp = num[i];
+		num[i] = num[size - 1 - i];
+		num[size - 1 - i] = tmp;
 	}
 
 	*buf_ptr++ = '.';
 
 	for(U8 i = 0; i < 3; ++i) {
-		samp_us *= 10;
-		*buf_ptr++ = ((U16)samp_us % 10) + '0';
+		frac *= 10;
+		*buf_ptr++ = ((U8)frac % 10) + '0';
+		frac -= (U8)frac;
 	}
 	
-	*buf_ptr++ = 'u';
+	if(unit)
+		*buf_ptr++ = unit;
 	*buf_ptr++ = 's';
 	*buf_ptr = '\0';
 	
-	PutsGenic(TVC_LABEL_OFFSETX, TVC_LABEL_OFFSETY + 18, (U8 *)"Time:", clWhite, clBlack, &ASC8X16);
-	PutsGenic(TVC_LABEL_OFFSETX + 5 * CHAR_WID, TVC_LABEL_OFFSETY + 18, t_buf, clWhite, clBlack, &ASC8X16);
+	render_text(RENDER_TEXT_TIME, TVC_LABEL_OFFSETX, TVC_LABEL_OFFSETY + 18, t_buf, clWhite, clBlack);
 }
 	
 U16 tvc_update(void)
@@ -230,7 +226,7 @@ U16 tvc_update(void)
 		if(dso_scope.tvc_x == WD_WIDTH - 1)
 			return 0;
 		++dso_scope.tvc_x;
-		dso_scope.tvc_y = wave.midpoint - GET_SAMPLE(wave.display_buf[dso_scope.tvc_x]);
+		dso_scope.tvc_y = wave.midpoint - GET_SAMPLE(FRAME_ADC(wave.display_buf[dso_scope.tvc_x]));
 		return 1;
 	}
 
@@ -239,37 +235,18 @@ U16 tvc_update(void)
 		if(dso_scope.tvc_x == 0)
 			return 0;
 		--dso_scope.tvc_x;
-		dso_scope.tvc_y = wave.midpoint - GET_SAMPLE(wave.display_buf[dso_scope.tvc_x]);
+		dso_scope.tvc_y = wave.midpoint - GET_SAMPLE(FRAME_ADC(wave.display_buf[dso_scope.tvc_x]));
 		return 1;
 	}
 	
 	return 0;
 }
 
+/* Redraw the trace on a fresh grid */
 void wf_display_only(void)
 {
-	U16 xpos = 10;
-	U16 i = 0, current_ypos = 0, prev_ypos = 0;
-	U16 current_val, prev_val;
-	S16 diff = 0;
-
-	for(; i < SAMPLES_NR; ++i, ++xpos) {
-		current_val = wave.display_buf[i];
-		current_ypos = GET_SAMPLE(current_val);
-		
-		/* Display sample accordingly */
-		diff = current_ypos - prev_ypos;
-		if(diff > 1 && diff <= WD_HEIGHT / 2 )
-			FillRect(xpos, wave.midpoint - current_ypos, 2, 2 + diff, WF_CL);
-		else if((diff < -1 && diff >= -(WD_HEIGHT / 2)))
-			FillRect(xpos, wave.midpoint - prev_ypos, 2, 2 - diff, WF_CL);
-		else
-			FillRect(xpos, wave.midpoint - current_ypos, 2, 2, WF_CL);
-
-		/* Update */
-		prev_ypos = current_ypos;
-		prev_val = current_val;
-	}
+	render_invalidate();
+	render_frame();
 }
 /* *
    * Buttons config 
@@ -291,57 +268,107 @@ void wf_display_only(void)
 
 }*/
 
-/* Read buttons state */
-U8 check_btn(GPIO_TypeDef* GPIOx, U16 GPIO_pin, U8 state){
-	if(GPIO_ReadInputDataBit(GPIOx, GPIO_pin) == state) {
-		U8 cnt = 0;
-		for(U8 i = 0; i < DEBOUNCE_TOTAL; ++i)
-			if(GPIO_ReadInputDataBit(GPIOx, GPIO_pin) == state)
-				++cnt;
-		if(cnt >= DEBOUNCE_LIM)
-			return 1;
+/* Frames taken with the old settings don't add up with the new ones */
+static void frames_reset(void)
+{
+	avg_reset();
+	if(persist.on)
+		persist_reset();
+}
+
+/* Roll mode and the triggered capture don't share a chain, restart it */
+static void timebase_update(void)
+{
+	dso_scope.timebase = timebases[dso_scope.tb_i].us;
+	if(dso_scope.rolling || ROLL_MODE())
+		sampling_stop();
+	frames_reset();
+}
+
+static void acq_update(void)
+{
+	if(dso_scope.rolling)
+		sampling_stop();
+	frames_reset();
+}
+
+/* Averaging goes on whatever the display mode */
+static void disp_update(void)
+{
+	persist_config(dso_scope.disp_i == DISP_PERSIST);
+	fft_config(DISP_FFT_WINDOW(dso_scope.disp_i));
+}
+
+/* Turn a debouncer event into the button flag, PLUS and MINUS repeat while held */
+static void btn_event(U8 arg)
+{
+	U8 i = BTN_ARG_IDX(arg), ev = BTN_ARG_EV(arg);
+
+	if(ev == BTN_RELEASE)
+		return;
+
+	if(i == BTN_IDX(PLUS_BTN_PIN))
+		BitSet(dso_scope.btns_flags, (1 << PLUS_BTN_BIT));
+	else if(i == BTN_IDX(MINUS_BTN_PIN))
+		BitSet(dso_scope.btns_flags, (1 << MINUS_BTN_BIT));
+	else if(ev == BTN_LONG)
+		return;
+	else if(i == BTN_IDX(SEL_BTN_PIN))
+		BitSet(dso_scope.btns_flags, (1 << SEL_BTN_BIT));
+	else if(i == BTN_IDX(OK_BTN_PIN))
+		BitSet(dso_scope.btns_flags, (1 << OK_BTN_BIT));
+}
+
+/* Waveform retrieve, answers the PROTO_SEND_WF command */
+static void wf_send(U8 seq)
+{
+	uart_frame_start(PROTO_WAVEFORM, seq, PROTO_WF_LEN);
+
+	/* Send timebase, the host protocol has 16 bits for it */
+	uart_frame_putU16((dso_scope.timebase > 0xFFFF) ? 0xFFFF : dso_scope.timebase);
+
+	/* Send samples */
+	for(U16 i=0; i < SAMPLES_NR; ++i) 
+		uart_frame_putU16(FRAME_ADC(wave.display_buf[i]));
+
+	uart_frame_end();
+}
+
+/* Loop and task loads, answers the PROTO_SEND_STATS command */
+static void stats_send(U8 seq)
+{
+	struct task *t;
+
+	uart_frame_start(PROTO_STATS, seq, PROTO_STATS_LEN(TASKS_NR));
+	uart_frame_put(loop.fps);
+	uart_frame_put(loop.idle);
+	uart_frame_put(TASKS_NR);
+
+	for(t = sched.tasks; t < sched.tasks + TASKS_NR; ++t) {
+		uart_frame_put(t->load);
+		uart_frame_putU16(t->skips);
+		uart_frame_putU16(t->max);
+		uart_frame_putU16(t->max >> 16);
 	}
-	return 0;
+
+	uart_frame_end();
 }
 
-#define CHECK_BTN(btn_flag_bit, btn_pin) \
-	 	if(BitTest(dso_scope.debounced, (1 << (btn_flag_bit))) && !check_btn(BTN_PORT, (btn_pin), RESET)) \
-			BitClr(dso_scope.debounced, (1 << (btn_flag_bit))); \
-		else if(!BitTest(dso_scope.debounced, (1 << (btn_flag_bit))) && check_btn(BTN_PORT, (btn_pin), RESET)){ \
-			BitSet(dso_scope.debounced, (1 << (btn_flag_bit))); \
-			BitSet(dso_scope.btns_flags, (1 << (btn_flag_bit))); \
-		}
 void btns_update(void)
 {
-	/* Test for waveform retrieve */
-	if(BitTest(dso_scope.btns_flags, (1 << SEND_WF_BIT))) {
-		/* Send timebase */
-		uputU16(dso_scope.timebase, USART1);
-
-		/* Send samples */
-		for(U16 i=0; i < SAMPLES_NR; ++i) 
-			uputU16(wave.display_buf[i], USART1);
-		
-		/* Reset flags */	
-		dso_scope.RX_flag = RX_WAITING;
-		dso_scope.RX_command = 0;
-		
-		BitClr(dso_scope.btns_flags, (1 << SEND_WF_BIT));
-	}
- 
 	/* If OK button was pressed */
 	if(BitTest(dso_scope.btns_flags, (1 << OK_BTN_BIT))) {
 		if(!BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT))) {
-			PutsGenic(SINGLES_OFFSETX, SINGLES_OFFSETY, (U8 *)"SINGLE", SINGLES_ACT_CL, clBlack, &ASC8X16);
-			/* Clear old waveform and display grid*/
-			FillRect(WD_OFFSETX, wave.midpoint - GET_SAMPLE(wave.max) - 10, WD_WIDTH, GET_SAMPLE((wave.max - wave.min)) + 3 + 20, BG_CL);
-			grid_display();
+			sampling_stop();
+			label_puts(LBL_SINGLE, SINGLES_OFFSETX, SINGLES_OFFSETY, (U8 *)"SINGLE", SINGLES_ACT_CL, clBlack);
+			/* Clear old waveform */
+			render_blank();
 			BitSet(dso_scope.btns_flags, (1 << SINGLES_BIT));
 		} else {
-			PutsGenic(SINGLES_OFFSETX, SINGLES_OFFSETY, (U8 *)"SINGLE", SINGLES_DEAC_CL, clBlack, &ASC8X16);
-			clr_blk(WD_OFFSETX, WD_OFFSETY, WD_WIDTH, WD_HEIGHT);
-			clr_blk(TVC_LABEL_OFFSETX, TVC_LABEL_OFFSETY + 18, 15 * CHAR_WID, 16);;
-			grid_display();
+			label_puts(LBL_SINGLE, SINGLES_OFFSETX, SINGLES_OFFSETY, (U8 *)"SINGLE", SINGLES_DEAC_CL, clBlack);
+			render_overlays_off();
+			render_blank();
+			sampling_stop();
 			BitClr(dso_scope.btns_flags, (1 << SINGLES_BIT));
 			BitClr(dso_scope.btns_flags, (1 << ANALYZING_BIT));
 			BitClr(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT));
@@ -358,6 +385,10 @@ void btns_update(void)
 		BitSet(dso_scope.btns_flags, (1 << LCURSOR_BIT));
 		BitSet(dso_scope.btns_flags, (1 << RCURSOR_BIT));
 		BitSet(dso_scope.btns_flags, (1 << TB_BIT));		
+		BitSet(dso_scope.btns_flags, (1 << TP_BIT));
+		BitSet(dso_scope.btns_flags, (1 << AVG_BIT));
+		BitSet(dso_scope.btns_flags, (1 << ACQ_BIT));
+		BitSet(dso_scope.btns_flags, (1 << DISP_BIT));
 	}
 
 	/* If PLUS button was pressed */
@@ -371,7 +402,7 @@ void btns_update(void)
 					/* Increase timebase */
 					BitSet(dso_scope.btns_flags, (1 << TB_BIT));
 					dso_scope.tb_i = (dso_scope.tb_i + 1) % TIMEBASE_NR;
-					dso_scope.timebase = timebase_vals[dso_scope.tb_i];
+					timebase_update();
 					break;
 				case l_cursor:
 					/* Move waveform upwards */
@@ -383,6 +414,30 @@ void btns_update(void)
 					BitSet(dso_scope.btns_flags, (1 << RCURSOR_BIT));
 					dso_scope.trig_lvl_adc += 100;
 					break;
+				case tp:
+					/* Move trigger point to the right */
+					BitSet(dso_scope.btns_flags, (1 << TP_BIT));
+					dso_scope.tp_i = (dso_scope.tp_i + 1) % TRIG_POS_NR;
+					frames_reset();
+					break;
+				case av:
+					/* Next averaging setting */
+					BitSet(dso_scope.btns_flags, (1 << AVG_BIT));
+					dso_scope.avg_i = (dso_scope.avg_i + 1) % AVG_MODES_NR;
+					avg_config(dso_scope.avg_i);
+					break;
+				case aq:
+					/* Next slow timebase acquisition mode */
+					BitSet(dso_scope.btns_flags, (1 << ACQ_BIT));
+					dso_scope.acq_i = (dso_scope.acq_i + 1) % ACQ_SEL_NR;
+					acq_update();
+					break;
+				case dm:
+					/* Next display mode */
+					BitSet(dso_scope.btns_flags, (1 << DISP_BIT));
+					dso_scope.disp_i = (dso_scope.disp_i + 1) % DISP_MODES_NR;
+					disp_update();
+					break;
 			} 
 		}
 	
@@ -401,8 +456,7 @@ void btns_update(void)
 					if(!dso_scope.tb_i)
 						dso_scope.tb_i = TIMEBASE_NR;
 					--dso_scope.tb_i;
-
-					dso_scope.timebase = timebase_vals[dso_scope.tb_i];
+					timebase_update();
 					break;
 				case l_cursor:
 					BitSet(dso_scope.btns_flags, (1 << LCURSOR_BIT));
@@ -414,6 +468,38 @@ void btns_update(void)
 					BitSet(dso_scope.btns_flags, (1 << RCURSOR_BIT));
 					dso_scope.trig_lvl_adc -= 100;
 					break;
+				case tp:
+					/* Move trigger point to the left */
+					BitSet(dso_scope.btns_flags, (1 << TP_BIT));
+					if(!dso_scope.tp_i)
+						dso_scope.tp_i = TRIG_POS_NR;
+					--dso_scope.tp_i;
+					frames_reset();
+					break;
+				case av:
+					/* Previous averaging setting */
+					BitSet(dso_scope.btns_flags, (1 << AVG_BIT));
+					if(!dso_scope.avg_i)
+						dso_scope.avg_i = AVG_MODES_NR;
+					--dso_scope.avg_i;
+					avg_config(dso_scope.avg_i);
+					break;
+				case aq:
+					/* Previous slow timebase acquisition mode */
+					BitSet(dso_scope.btns_flags, (1 << ACQ_BIT));
+					if(!dso_scope.acq_i)
+						dso_scope.acq_i = ACQ_SEL_NR;
+					--dso_scope.acq_i;
+					acq_update();
+					break;
+				case dm:
+					/* Previous display mode */
+					BitSet(dso_scope.btns_flags, (1 << DISP_BIT));
+					if(!dso_scope.disp_i)
+						dso_scope.disp_i = DISP_MODES_NR;
+					--dso_scope.disp_i;
+					disp_update();
+					break;
 			}
 		}
 
@@ -421,40 +507,74 @@ void btns_update(void)
 	}
 }
 
-void read_btns(void) {
-	if(dso_scope.RX_flag == RX_WAITING) {
-		CHECK_BTN(PLUS_BTN_BIT, PLUS_BTN_PIN);
-		CHECK_BTN(MINUS_BTN_BIT, MINUS_BTN_PIN);
-		CHECK_BTN(SEL_BTN_BIT, SEL_BTN_PIN);
-		CHECK_BTN(OK_BTN_BIT, OK_BTN_PIN);
-	} else 
-		USART1_set_flags();
+/* Events posted by the interrupts, see loop.h. EV_FRAME is the main loop's. */
+void scope_event(struct event *ev)
+{
+	static U8 timeout;
+
+	switch(ev->type) {
+	case EV_TRIG_TIMEOUT:
+		/* Marks the capture that follows it */
+		timeout = 1;
+		return;
+	case EV_CAPTURE:
+		if(ev->arg & CAPT_SINGLE)
+			BitSet(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT));
+		/* The trigger level cursor shows untriggered captures */
+		if(dso_scope.trig_auto != timeout) {
+			dso_scope.trig_auto = timeout;
+			BitSet(dso_scope.btns_flags, (1 << RCURSOR_BIT));
+		}
+		timeout = 0;
+		return;
+	case EV_BUTTON:
+		btn_event(ev->arg);
+		break;
+	case EV_SERIAL:
+		/* Commands arrive through scope_command() */
+		uart_poll();
+		return;
+	default:
+		return;
+	}
 
+	/* One at a time, repeated presses must not merge into one flag */
 	btns_update();
 }
 
-void USART1_set_flags(void)
+/* A host command frame, see protocol.h. Answered before the next one. */
+void scope_command(U8 type, U8 seq)
 {
-	switch(dso_scope.RX_command) {
-	case SERIAL_SEL:
+	switch(type) {
+	case PROTO_SEL:
 		BitSet(dso_scope.btns_flags, (1 << SEL_BTN_BIT));
 		break;
-	case SERIAL_SINGLE:
+	case PROTO_SINGLE:
 		BitSet(dso_scope.btns_flags, (1 << OK_BTN_BIT));
 		break;
-	case SERIAL_PLUS:
+	case PROTO_PLUS:
 		BitSet(dso_scope.btns_flags, (1 << PLUS_BTN_BIT));
 		break;
-	case SERIAL_MINUS:
+	case PROTO_MINUS:
 		BitSet(dso_scope.btns_flags, (1 << MINUS_BTN_BIT));
 		break;
-	case SERIAL_SEND_WF:
-		if(BitTest(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT)))
-			BitSet(dso_scope.btns_flags, (1 << SEND_WF_BIT));
-		break;
+	case PROTO_SEND_WF:
+		if(!BitTest(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT))) {
+			uart_nak(seq, PROTO_ERR_NO_WF);
+			return;
+		}
+		wf_send(seq);
+		return;
+	case PROTO_SEND_STATS:
+		stats_send(seq);
+		return;
+	default:
+		uart_nak(seq, PROTO_ERR_TYPE);
+		return;
 	}
 
-	dso_scope.RX_flag = RX_WAITING;
+	uart_ack(seq);
+	btns_update();
 }
 
 /*
@@ -470,6 +590,7 @@ void ADCs_Init(void)
 	ADC_InitTypeDef ADC_InitStructure;
 	 
 	ADC_DeInit(ADC1);
+	ADC_DeInit(ADC2);
 	ADC_InitStructure.ADC_Mode = ADC_Mode_Independent;
 	ADC_InitStructure.ADC_ScanConvMode = DISABLE; // 1 Channel
 	ADC_InitStructure.ADC_ContinuousConvMode = DISABLE; // Conversions Triggered 
@@ -477,14 +598,19 @@ void ADCs_Init(void)
 	ADC_InitStructure.ADC_DataAlign = ADC_DataAlign_Right;
 	ADC_InitStructure.ADC_NbrOfChannel = 1;
 	ADC_Init(ADC1, &ADC_InitStructure);
+
+	/* ADC2 is only used as the slave in interleaved mode, started by ADC1 */
+	ADC_InitStructure.ADC_ExternalTrigConv = ADC_ExternalTrigConv_None;
+	ADC_Init(ADC2, &ADC_InitStructure);
 	 
-	// ADC1 regular channel 4 configuration 
+	// ADC1 and ADC2 regular channel 4 configuration 
 	ADC_RegularChannelConfig(ADC1, ADC_Channel_4, 1, ADC_SampleTime_1Cycles5);
+	ADC_RegularChannelConfig(ADC2, ADC_Channel_4, 1, ADC_SampleTime_1Cycles5);
 	 
-	/* Enable end of conversion interrupt */
-	ADC_ITConfig(ADC1, ADC_IT_EOC , ENABLE);
 	ADC_Cmd(ADC1, ENABLE);
+	ADC_Cmd(ADC2, ENABLE);
 	ADC_DMACmd(ADC1, ENABLE);
+	ADC_ExternalTrigConvCmd(ADC2, ENABLE);
 	 
 	/* Enable ADC1 reset calibration register */   
 	ADC_ResetCalibration(ADC1);
@@ -498,9 +624,51 @@ void ADCs_Init(void)
 	/* Check the end of ADC1 calibration */
 	while(ADC_GetCalibrationStatus(ADC1));
 
+	/* Same for ADC2 */
+	ADC_ResetCalibration(ADC2);
+	while(ADC_GetResetCalibrationStatus(ADC2));
+	ADC_StartCalibration(ADC2);
+	while(ADC_GetCalibrationStatus(ADC2));
+
+	ADC_Cmd(ADC2, DISABLE);
+	dso_scope.acq_mode = ACQ_SINGLE;
+
 	ADC_SoftwareStartConvCmd(ADC1, ENABLE);
 }
 
+/*
+ * Switch between one ADC and ADC1/ADC2 in fast interleaved mode.
+ * Peak detect and hi-res use ADC1 alone like ACQ_SINGLE.
+ * In interleaved mode the ADC clock is lowered to 9MHz so that the 7 ADC clock
+ * delay between ADC2 and ADC1 is exactly half of the 14 clock pair period
+ * (ADC_PAIR_CLKS), giving evenly spaced samples at 1.286MHz.
+ * DMA then moves both results at once as a 32 bit word (see ADC_PAIR_FIRST).
+ */
+void acq_mode_config(U8 mode)
+{
+	if(mode == dso_scope.acq_mode)
+		return;
+
+	ADC_Cmd(ADC1, DISABLE);
+	ADC_Cmd(ADC2, DISABLE);
+
+	if(mode == ACQ_INTERLEAVED) {
+		ADC1->CR1 = (ADC1->CR1 & ~ADC_CR1_DUALMOD) | ADC_Mode_FastInterl;
+		RCC_ADCCLKConfig(RCC_PCLK2_Div8);
+		DMA_struct.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+		DMA_struct.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+		ADC_Cmd(ADC2, ENABLE);
+	} else {
+		ADC1->CR1 = (ADC1->CR1 & ~ADC_CR1_DUALMOD) | ADC_Mode_Independent;
+		RCC_ADCCLKConfig(RCC_PCLK2_Div6);
+		DMA_struct.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+		DMA_struct.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+	}
+
+	ADC_Cmd(ADC1, ENABLE);
+	dso_scope.acq_mode = mode;
+}
+
 #define ADC1_DR_Address    ((uint32_t)0x4001244C)
 
 void DMA_Configuration(void)
@@ -518,10 +686,8 @@ void DMA_Configuration(void)
 	  DMA_struct.DMA_Priority = DMA_Priority_High;
 	  DMA_struct.DMA_M2M = DMA_M2M_Disable;
 	  DMA_Init(DMA1_Channel1, &DMA_struct);  
-	 
-	  /* Enable DMA Stream Transfer Complete interrupt */
-	  DMA_ITConfig(DMA1_Channel1, DMA_IT_TC, ENABLE);
 
+	  /* Runs continuously, the frame end is counted by TIM2 (see trigger.h) */
 }
 
 #define TIM2_FREQ_HZ	36000000
@@ -567,19 +733,19 @@ void NVIC_Configuration(void)
 {
 	NVIC_InitTypeDef NVIC_InitStructure;
 	 
-	/* Enable the DMA Stream IRQ Channel */
-	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel1_IRQn;
+	// Enable the TIM3 Interrupt 
+	NVIC_InitStructure.NVIC_IRQChannel = TIM3_IRQn;
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
 	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
-	NVIC_Init(&NVIC_InitStructure);
+	NVIC_Init(&NVIC_InitStructure); 
 
-	// Enable the TIM3 Interrupt 
-	NVIC_InitStructure.NVIC_IRQChannel = TIM3_IRQn;
+	/* Trigger sample counter */
+	NVIC_InitStructure.NVIC_IRQChannel = TIM2_IRQn;
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
 	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
-	NVIC_Init(&NVIC_InitStructure); 
+	NVIC_Init(&NVIC_InitStructure);
 
 	/* Enable TIM4 interrupt */
 	/*NVIC_InitStructure.NVIC_IRQChannel = TIM4_IRQn;
@@ -588,7 +754,27 @@ void NVIC_Configuration(void)
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_Init(&NVIC_InitStructure);*/ 
 	
-	/* Analog to digital converter interrupt */
+	/* Frequency counter, captures done and timestamp overflow */
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel2_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+
+	NVIC_InitStructure.NVIC_IRQChannel = TIM1_UP_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+
+	/* Peak detect pixel reduction */
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel1_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_Init(&NVIC_InitStructure);
+
+	/* Analog watchdog (trigger) interrupt */
 	NVIC_InitStructure.NVIC_IRQChannel = ADC1_2_IRQn;
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
 	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
@@ -615,6 +801,10 @@ void sampling_config(void)
 
 	DMA_Configuration();
 
+	trigger_config();
+
+	freqcnt_config();
+
 	//TIM4_Configuration();
 
 	NVIC_Configuration();
@@ -629,50 +819,168 @@ void sampling_config(void)
 	*
 */
 
+/*
+ * Start the capture chain if it is not running. Once started, every completed
+ * frame restarts the trigger search from the ISR, so capture overlaps drawing.
+ */
 void sampling_enable(void)
 {
-	dso_scope.done_displaying = 0;
-	dso_scope.done_sampling = 0;
-
 	if(BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT))) {
 		dso_scope.done_sampling = 1;
 		if(BitTest(dso_scope.btns_flags, (1 << SS_STARTED_BIT)))
 			return;
 		else
 			BitSet(dso_scope.btns_flags, (1 << SS_STARTED_BIT));
-	}
+	} else if(dso_scope.acquiring)
+		return;
 
-	dso_scope.avg_total = 32;
-	dso_scope.prev_cal_samp = ADC_MAX;
-	dso_scope.test_timer = dso_scope.timebase / 2;	
+	if(ROLL_MODE())
+		roll_start();
+	else
+		trigger_search();
+}
 
-	/* 10us and 20us special handling */
-	/* Sample only a half/quarter of the total amount */
-	if(dso_scope.timebase == 20) {
-		DMA_struct.DMA_BufferSize = SAMPLES_NR / 2;
-		DMA_Init(DMA1_Channel1, &DMA_struct);
-	} else if(dso_scope.timebase == 10) {
-		DMA_struct.DMA_BufferSize = SAMPLES_NR / 4;
-		DMA_Init(DMA1_Channel1, &DMA_struct);
-	}
-	else {
-		DMA_struct.DMA_BufferSize = SAMPLES_NR;
-		DMA_Init(DMA1_Channel1, &DMA_struct);
-	}
-	TIM3_struct.TIM_Period = 72;
+void sampling_stop(void)
+{
+	trigger_disarm();
+	TIM_Cmd(TIM3, DISABLE);
+	DMA_Cmd(DMA1_Channel1, DISABLE);
+	dso_scope.acquiring = 0;
+
+	/* Drop a frame captured with the old settings */
+	wave.frame_ready = 0;
+	frames_reset();
+
+	roll_stop();
+}
+
+/* TIM3 update every (psc + 1) * (arr + 1) timer clocks */
+static void tim3_rate(U16 psc, U16 arr)
+{
+	TIM3_struct.TIM_Prescaler = psc;
+	TIM3_struct.TIM_Period = arr;
 	TIM_TimeBaseInit(TIM3, &TIM3_struct);
 	/* TIM3 TRGO selection */
 	TIM_SelectOutputTrigger(TIM3, TIM_TRGOSource_Update); // ADC_ExternalTrigConv_T3_TRGO
+}
+
+/*
+ * Set up the ring for the current settings and start sampling into it.
+ * Returns the conversions per ring entry.
+ */
+U16 acq_start(void)
+{
+	const struct timebase *t = &timebases[dso_scope.tb_i];
+	U16 decim = 1, psc = t->psc, arr = t->arr;
+	U32 pres;
+	U8 mode = t->mode;
+
+	trigger_disarm();
+	TIM_Cmd(TIM3, DISABLE);
+	DMA_Cmd(DMA1_Channel1, DISABLE);
+
+	/* Peak detect and hi-res: sample [decim] times faster, one ring entry per pixel */
+	pres = TB_PERIOD(t);
+	if(acq_sel_modes[dso_scope.acq_i] != ACQ_SINGLE && PEAK_DECIM(pres)) {
+		mode = acq_sel_modes[dso_scope.acq_i];
+		decim = PEAK_DECIM(pres);
+		pres = (pres + decim / 2) / decim;
+		psc = TB_PSC(pres) - 1;
+		arr = TB_ARR(pres) - 1;
+	}
+
+	acq_mode_config(mode);
+
+	/* 10us and 20us special handling */
+	/* The ring holds ADC1/ADC2 pairs, 10us only gets half of the samples */
+	if(dso_scope.timebase == 20)
+		wave.ring_len = SAMPLES_NR / 2;
+	else if(dso_scope.timebase == 10)
+		wave.ring_len = SAMPLES_NR / 4;
+	else
+		wave.ring_len = SAMPLES_NR;
+
+	if(ACQ_DECIMATED(mode)) {
+		peak_start(decim);
+		DMA_struct.DMA_MemoryBaseAddr = (U32)peak.sub_buf;
+		DMA_struct.DMA_BufferSize = 2 * decim;
+	} else {
+		DMA_struct.DMA_MemoryBaseAddr = (U32)wave.tmp_buf;
+		DMA_struct.DMA_BufferSize = wave.ring_len;
+	}
+	DMA_Init(DMA1_Channel1, &DMA_struct);
+	DMA_ClearITPendingBit(DMA1_IT_GL1);
+	DMA_ITConfig(DMA1_Channel1, DMA_IT_HT | DMA_IT_TC, ACQ_DECIMATED(mode) ? ENABLE : DISABLE);
+	DMA_Cmd(DMA1_Channel1, ENABLE);
+
+	tim3_rate(psc, arr);
 	TIM_Cmd(TIM3, ENABLE);
+	dso_scope.acquiring = 1;
+
+	return decim;
+}
+
+/* Sample continuously into the ring and let the analog watchdog look for a trigger */
+void trigger_search(void)
+{
+	U16 pre, decim;
 
-	/* Enable ADC interrupts */
-	ADC_ITConfig(ADC1, ADC_IT_EOC , ENABLE);
+	decim = acq_start();
+	pre = TRIG_PRE(wave.ring_len, trig_pos_vals[dso_scope.tp_i]);
+
+	/* No timeout in single shot mode, wait for a real trigger */
+	if(BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT)))
+		trigger_start(dso_scope.trig_lvl_adc, pre, wave.ring_len - pre - 1, 0, decim);
+	else
+		trigger_start(dso_scope.trig_lvl_adc, pre, wave.ring_len - pre - 1,
+					TRIG_TIMEOUT(wave.ring_len), decim);
+}
+
+/*
+ * Hand the last captured frame over to the display, no copy needed.
+ * Returns 1 if display_buf holds a new frame.
+ */
+U8 frame_swap(void)
+{
+	__IO U16 *tmp;
+	U8 swapped = 0;
+
+	/* The capture ISR writes avg_buf */
+	NVIC_DisableIRQ(TIM2_IRQn);
+	if(wave.frame_ready) {
+		tmp = wave.display_buf;
+		wave.display_buf = wave.avg_buf;
+		wave.avg_buf = tmp;
+
+		tmp = wave.display_min;
+		wave.display_min = wave.avg_min;
+		wave.avg_min = tmp;
+		wave.display_peak = wave.avg_peak;
+		wave.display_shift = wave.avg_shift;
+		wave.display_align = wave.avg_align;
+
+		wave.frame_ready = 0;
+		swapped = 1;
+	}
+
+	/* Wait for the next frame, single shot and roll keep polling the buttons */
+	if(!BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT)) && !dso_scope.rolling)
+		dso_scope.done_sampling = 0;
+	NVIC_EnableIRQ(TIM2_IRQn);
+
+	return swapped;
 }
 
-void fill_display_buf(void)
+/*
+ * Shift the front buffer so the trigger edge found by trigger_align() sits
+ * on the trigger sample, interpolating between the samples. Successive
+ * frames then line up to a fraction of a sample instead of jittering by
+ * the watchdog latency.
+ */
+void frame_align(void)
 {
-	for(int i = 0; i < SAMPLES_NR; ++i) 
-		wave.display_buf[i] = wave.avg_buf[i];
+	trigger_shift(wave.display_buf, wave.display_align);
+	wave.display_align = 0;
 }
 
 void get_digits(U32 n, U8 *dig_buf)
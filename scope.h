@@ -5,6 +5,8 @@
 
 #include "Common.h"
 #include "Screen.h"
+#include "loop.h"
+#include "protocol.h"
 
 #define SAMPLES_NR		300
 #define BLK_MV			1000					/* Milivolts in one block */
@@ -17,14 +19,11 @@
 /* Convert ADC value to pixels */
 #define GET_SAMPLE(x)		( (x) / ADC_VAL_DEL) 
 #define ADC_MV_PER_DIV		0.8
+#define ADC_MV(x)		((U32)(x) * 4 / 5)		/* ADC_MV_PER_DIV in integers */
 
 /* Noise */
 #define NOISE_MARGIN		40	/* ~32mv */
 
-/* Debouncing parameters */
-#define DEBOUNCE_TOTAL		250
-#define DEBOUNCE_LIM		100
-
 /* Buttons */
 #define BTN_PORT		GPIOB
 
@@ -49,82 +48,184 @@
 #define SS_STARTED_BIT		9
 #define SS_CAPTURED_BIT		10
 
-#define SEND_WF_BIT		11
+#define TP_BIT			12
+#define AVG_BIT			13
+#define ACQ_BIT			14
+#define DISP_BIT		15
 
-#define SEL_NR			3
+#define SEL_NR			7
 
 typedef enum {
 	l_cursor = 0,
 	r_cursor,
-	tb
+	tb,
+	tp,
+	av,
+	aq,
+	dm
 } selected;
 
+/* Display modes, what the wave display shows of the (averaged) frames */
+#define DISP_WAVE		0
+#define DISP_PERSIST		1	/* Trace over its persistence, see persist.h */
+#define DISP_FFT		2	/* Spectrum, one mode per window, see fft.h */
+#define DISP_MODES_NR		(DISP_FFT + FFT_WINDOWS_NR)
+#define DISP_FFT_WINDOW(i)	((i) >= DISP_FFT ? (i) - DISP_FFT : FFT_OFF)
+
 /* Timebase */
-#define TIMEBASE_NR		8 /* Number of existing timebases */
+#define TIMEBASE_NR		19 /* Number of existing timebases */
+#define TB_DIVS			12	/* Horizontal divisions per frame */
+#define TIM3_CLK_MHZ		72
+
+/*
+ * TIM3 clocks per sample at [us] per division. Exact for every 1-2-5
+ * timebase from 50us up since SAMPLES_NR / TB_DIVS == 25.
+ */
+#define TB_CLKS(us)		((U32)(us) * TIM3_CLK_MHZ / (SAMPLES_NR / TB_DIVS))
+
+/*
+ * Prescaler for [clks]: plain clocks, 1us or 10us ticks, whichever divides
+ * exactly and leaves a 16 bit period. Falls back to the smallest one.
+ */
+#define TB_PSC_FITS(clks, p)	((clks) % (p) == 0 && (clks) / (p) <= 0x10000)
+#define TB_PSC(clks)		(TB_PSC_FITS(clks, 1) ? 1 : \
+				TB_PSC_FITS(clks, TIM3_CLK_MHZ) ? TIM3_CLK_MHZ : \
+				TB_PSC_FITS(clks, 10 * TIM3_CLK_MHZ) ? 10 * TIM3_CLK_MHZ : \
+				(clks) / 0x10000 + 1)
+#define TB_ARR(clks)		((clks) / TB_PSC(clks))
+
+/*
+ * Table entries, register values are stored minus one. An entry doesn't
+ * compile unless it samples at its nominal interval: TIMEBASE() exactly,
+ * i.e. TB_PERIOD() is [us] * TIM3_CLK_MHZ * TB_DIVS / SAMPLES_NR clocks,
+ * TIMEBASE_PAIR() within TB_PAIR_TOL percent for the [px] frame samples
+ * a conversion pair covers.
+ */
+#define TB_ASSERT(c)		(0 * sizeof(char[(c) ? 1 : -1]))
+#define TB_EXACT(us)		(TB_CLKS(us) * (SAMPLES_NR / TB_DIVS) == (U32)(us) * TIM3_CLK_MHZ && \
+				TB_PSC(TB_CLKS(us)) * TB_ARR(TB_CLKS(us)) == TB_CLKS(us))
+#define TB_PAIR_TOL		3
+#define TB_PAIR_N(us, px)	((U32)(px) * (us) * TIM3_CLK_MHZ)	/* Nominal clocks * SAMPLES_NR / TB_DIVS */
+#define TB_PAIR_ERR(us, px)	(ADC_PAIR_CLKS * (SAMPLES_NR / TB_DIVS) > TB_PAIR_N(us, px) ? \
+				ADC_PAIR_CLKS * (SAMPLES_NR / TB_DIVS) - TB_PAIR_N(us, px) : \
+				TB_PAIR_N(us, px) - ADC_PAIR_CLKS * (SAMPLES_NR / TB_DIVS))
+#define TB_PAIR_NEAR(us, px)	(100 * TB_PAIR_ERR(us, px) <= TB_PAIR_TOL * TB_PAIR_N(us, px))
+
+#define TIMEBASE_CLKS(us, clks, mode)	{ (us), TB_PSC(clks) - 1, TB_ARR(clks) - 1, (mode) }
+#define TIMEBASE(us)		TIMEBASE_CLKS((us) + TB_ASSERT(TB_EXACT(us)), TB_CLKS(us), ACQ_SINGLE)
+#define TIMEBASE_PAIR(us, px)	TIMEBASE_CLKS((us) + TB_ASSERT(TB_PAIR_NEAR(us, px)), ADC_PAIR_CLKS, ACQ_INTERLEAVED)
+#define TB_PERIOD(t)		((U32)((t)->psc + 1) * ((t)->arr + 1))
+
+struct timebase {
+	U32 us;				/* Per division */
+	U16 psc;			/* TIM3 prescaler */
+	U16 arr;			/* TIM3 period */
+	U8 mode;			/* Acquisition mode */
+};
+
+/* Acquisition modes */
+#define ACQ_SINGLE		0	/* ADC1 only */
+#define ACQ_INTERLEAVED		1	/* ADC1 + ADC2 fast interleaved, twice the sample rate */
+#define ACQ_PEAK		2	/* ADC1 at full rate, min/max per pixel (see peak.h) */
+#define ACQ_HIRES		3	/* ADC1 at full rate, mean per pixel with HIRES_SHIFT more bits */
+#define ACQ_DECIMATED(m)	((m) >= ACQ_PEAK)
+
+/* Modes selectable for the slow timebases */
+#define ACQ_SEL_NR		3
+
+/* Interleaved pair period: 14 ADC clocks at 9MHz, in 72MHz timer clocks */
+#define ADC_PAIR_CLKS		112
+
+/* Unpack an interleaved DMA word, ADC2 converts 7 ADC clocks before ADC1 */
+#define ADC_PAIR_FIRST(w)	((U16)((w) >> 16))	/* ADC2 */
+#define ADC_PAIR_SECOND(w)	((U16)((w) & 0xFFFF))	/* ADC1 */
+
+/* Trigger position, percent of the frame before the trigger */
+#define TRIG_POS_NR		5
+#define TRIG_PRE(len, pos)	((U32)(len) * (pos) / 100)
+
+/* Ring buffer index of the i-th sample of the captured frame */
+#define RING_IDX(i)		((wave.start + (i)) >= wave.ring_len ? \
+					(wave.start + (i)) - wave.ring_len : \
+					(wave.start + (i)))
+
+/* Front buffer sample in ADC units, hi-res frames have fraction bits */
+#define FRAME_ADC(v)		((v) >> wave.display_shift)
 
 /* Frequency */
-#define GET_FREQ(freq_cnt)	(1000000.0 / (((U32)dso_scope.timebase * 12000 / SAMPLES_NR) * (freq_cnt)))
 #define FREQ_DELAY		15
 
-/* USART Flags */
-#define ACK			0x01
-#define NEED_ACK		0x02
-#define	RESEND			0x03
-#define RX_DONE 		0x04
-#define RX_WAITING		0x05
-
-/* USART Commands */
-#define SERIAL_SEL		0x04
-#define SERIAL_PLUS		0x05
-#define SERIAL_MINUS		0x06
-#define SERIAL_SINGLE		0x07
-#define SERIAL_SEND_WF		0x08
-#define WF_SENDING		0x09
+/* USART1, see protocol.h */
+#if PROTO_WF_SAMPLES != SAMPLES_NR
+#error "PROTO_WF_SAMPLES doesn't match SAMPLES_NR"
+#endif
 
 /* Time-voltage coursor */
 #define TVC_PLUS_BIT		0
 #define TVC_MINUS_BIT		1
 
 struct waveform {
-	__IO U16 tmp_buf[SAMPLES_NR];
-	__IO U16 avg_buf[SAMPLES_NR];
-	__IO U16 display_buf[SAMPLES_NR];
+	union {
+		__IO U16 tmp_buf[SAMPLES_NR];		/* DMA ring */
+		__IO U32 pair_buf[SAMPLES_NR / 2];	/* DMA ring, interleaved mode */
+		__IO U32 peak_buf[SAMPLES_NR];		/* Max/min or hi-res ring, decimated modes */
+	};
+	__IO U16 frames[2][SAMPLES_NR];		/* Ping-pong frame buffers */
+	__IO U16 frames_min[2][SAMPLES_NR];	/* Pixel minimums of peak detect frames */
+	__IO U16 *avg_buf;			/* Back buffer, written by the capture ISR */
+	__IO U16 *avg_min;
+	__IO U8 avg_peak;			/* Back buffer is a peak detect frame */
+	__IO U8 avg_shift;			/* Fraction bits of the back buffer samples */
+	__IO U16 *display_buf;			/* Front buffer, owned by the main loop */
+	__IO U16 *display_min;			/* Only valid if display_peak is set */
+	__IO U8 display_peak;
+	__IO U8 display_shift;
+	__IO U8 frame_ready;			/* avg_buf holds a frame not yet displayed */
+	__IO S16 avg_align;			/* Trigger edge offset of the back buffer, 1/MEAS_FRAC samples */
+	S16 display_align;			/* Same for the front buffer, until frame_align() */
 	
+	U16 ring_len;				/* Samples in the DMA ring */
+	__IO U16 start;				/* Ring index of the first sample of the frame */
+
 	U8 midpoint;
-	double frequency;
 	U16 max;
 	U16 min;
 	U16 pp_v;
 };
 
 struct scope {
-	/* USART1 receive buffer */
-	__IO U16 RX_command;
-	__IO U8 RX_flag;
-
 	/* Real-time/Trigger mode */
 	__IO U8 rt_mode;
-	__IO U16 rt_timer ;
 
 	/* Timebase */
 	__IO S8 tb_i;
-	__IO U16 timebase;
+	__IO U32 timebase;			/* us/div */
+
+	/* Trigger position */
+	__IO U8 tp_i;
+
+	/* Acquisition mode */
+	__IO U8 acq_mode;
+
+	/* Averaging setting, see AVG_MODES_NR */
+	__IO U8 avg_i;
+
+	/* Slow timebase acquisition mode, index to acq_sel_modes[] */
+	__IO U8 acq_i;
+
+	/* Display mode, DISP_* */
+	__IO U8 disp_i;
 
 	/* Interrupt flags */
 	__IO U8 done_sampling;
-	__IO U8 done_displaying;
-
-	/* Averaging */
-	__IO U8 avg_flag;
-	__IO U8 avg_total;
+	__IO U8 acquiring;			/* Capture chain is running */
+	__IO U8 rolling;			/* Roll mode, see roll.h */
 
 	/* ADC Trigger level */
 	__IO U16 trig_lvl_adc;
-	__IO U16 test_timer;
-	U16 prev_cal_samp; 		/* Previous sample */
+	U8 trig_auto;				/* Last capture timed out, not triggered */
 
 	/* Buttons */
-	__IO U8 debounced;
 	__IO U16 btns_flags;
 	__IO U8 btn_selected;
 
@@ -150,16 +251,20 @@ void NVIC_Configuration(void);
 
 /* Sampling */
 void sampling_config(void); /* Configure ADC1, DMA, TIM3 */
+void acq_mode_config(U8 mode);
 void sampling_enable(void);
-void fill_display_buf(void);
+void sampling_stop(void);
+void trigger_search(void);
+U16 acq_start(void);
+U8 frame_swap(void);
+void frame_align(void);
 
 /* Buttons */
-void read_btns(void);
+void scope_event(struct event *ev);
 void btns_update(void);
-U8 check_btn(GPIO_TypeDef* GPIOx, U16 GPIO_pin, U8 state);
 
 /* USART1 */
-void USART1_set_flags(void);
+void scope_command(U8 type, U8 seq);
 
 /* Time-voltage coursor */
 void tvc_display(U16 tvc_x, U16 tvc_y);
@@ -26,11 +26,18 @@
 #include "Common.h"
 #include "Board.h"
 #include "scope.h"
+#include "trigger.h"
+#include "peak.h"
+#include "freqcnt.h"
+#include "btn.h"
+#include "loop.h"
+#include "uart.h"
+#include "Screen.h"
 
 extern __IO struct scope dso_scope;
 extern __IO struct waveform wave;
 extern __IO TIM_TimeBaseInitTypeDef TIM3_struct;
-extern U16 timebase_pres[];
+extern struct trigger trig;
 
 /** @addtogroup STM32F10x_StdPeriph_Examples
   * @{
@@ -144,22 +151,11 @@ void PendSV_Handler(void)
   * @param  None
   * @retval None
   */
-/*void SysTick_Handler(void)
+void SysTick_Handler(void)
 {
- // Key scan
- if(--TimerKeyScan == 0) {
-	TimerKeyScan = 10;	// 10ms
-	BitSet(Keypad.Flags, (1 << KF_DoKeyScan));
- 	}
-
- // General timer
- if(GTimer) {
-	GTimer--;
-	if(GTimer == 0) {
-		GTimeout = 1;
-		}
- 	}
-}*/
+	loop_tick();
+	btn_tick();
+}
 
 /******************************************************************************/
 /*                 STM32F10x Peripherals Interrupt Handlers                  		*/
@@ -177,80 +173,87 @@ void PendSV_Handler(void)
 {
 }*/
 
-#define INTERPOLATE(x1, y1, x2, y2, x) 	y1 + ((double)(x - x1) * (y2 - y1)) / (double)(x2 - x1)
- 	
-void DMA1_Channel1_IRQHandler(void)
+/* i-th sample of the captured frame, unpacking ADC pairs in interleaved mode */
+static inline U16 frame_sample(U16 i)
 {
-	/* Test on DMA Stream Transfer Complete interrupt */
-	if(DMA_GetITStatus(DMA_IT_TC)) {
+	if(dso_scope.acq_mode == ACQ_INTERLEAVED) {
+		U32 pair = wave.pair_buf[RING_IDX(i >> 1)];
+		return (i & 1) ? ADC_PAIR_SECOND(pair) : ADC_PAIR_FIRST(pair);
+	}
 
-	/* Clear DMA Transfer Complete interrupt pending bit */
-	DMA_ClearITPendingBit(DMA_IT_TC);
+	return wave.tmp_buf[RING_IDX(i)];
+}
 
-	/* Disable DMA Channel while the waveform is displayed */
-	DMA_Cmd(DMA1_Channel1, DISABLE);
+/* Post-trigger samples are in, unroll the ring into the back buffer */
+static void capture_done(void)
+{
+	U16 val, n, last, at;
+
+	/* Stop sampling while the ring is unrolled */
+	trigger_disarm();
 	TIM_Cmd(TIM3, DISABLE);
+	DMA_Cmd(DMA1_Channel1, DISABLE);
 
-	if(dso_scope.timebase == 20) {
-		for(U16 i = 0; i < SAMPLES_NR; i += 2)
-			if(dso_scope.avg_flag)
-				wave.avg_buf[i] = wave.avg_buf[i + 1] = wave.tmp_buf[i / 2];
-			else 
-				wave.avg_buf[i] = wave.avg_buf[i + 1] = (wave.avg_buf[i] + wave.tmp_buf[i / 2]) / 2;
-	} else if(dso_scope.timebase == 10 ) {
-		for(U16 i = 0; i < SAMPLES_NR; i += 4)
-			if(dso_scope.avg_flag) {
-				wave.avg_buf[i] = wave.tmp_buf[i / 4];
-				if (i + 4 == SAMPLES_NR)
-					wave.avg_buf[i + 3] = wave.tmp_buf[i / 4];
-				else
-					wave.avg_buf[i+3] = wave.tmp_buf[(i + 4) / 4];
-
-				wave.avg_buf[i + 1] = INTERPOLATE(0, wave.avg_buf[i], 4, wave.avg_buf[i + 3], 1);
-				wave.avg_buf[i + 2] = INTERPOLATE(0, wave.avg_buf[i], 4, wave.avg_buf[i + 3], 2);
-			} else {
-				wave.avg_buf[i] = (wave.avg_buf[i] + wave.tmp_buf[i / 4]) / 2;
-				if (i + 4 == SAMPLES_NR)
-					wave.avg_buf[i + 3] = (wave.avg_buf[i] + wave.tmp_buf[i / 4]) / 2;
-				else
-					wave.avg_buf[i+3] = (wave.avg_buf[i] + wave.tmp_buf[(i + 4) / 4]) / 2;				
-								
-				wave.avg_buf[i+1] = (wave.avg_buf[i] + INTERPOLATE(0, wave.avg_buf[i], 4, wave.avg_buf[i + 3], 1)) / 2;
-				wave.avg_buf[i+2] = (wave.avg_buf[i] + INTERPOLATE(0, wave.avg_buf[i], 4, wave.avg_buf[i + 3], 2)) / 2;
-			}
-	}
-	else {
+	/* Oldest sample of the frame, the trigger is trig.pre samples later */
+	wave.start = trig.index + wave.ring_len - trig.pre;
+	if(wave.start >= wave.ring_len)
+		wave.start -= wave.ring_len;
+
+	/* Peak detect, one max/min pair per pixel */
+	wave.avg_peak = (dso_scope.acq_mode == ACQ_PEAK);
+	wave.avg_shift = (dso_scope.acq_mode == ACQ_HIRES) ? HIRES_SHIFT : 0;
+	if(wave.avg_peak) {
+		for(U16 i = 0; i < SAMPLES_NR; ++i) {
+			U32 w = wave.peak_buf[RING_IDX(i)];
+			wave.avg_buf[i] = PEAK_MAX(w);
+			wave.avg_min[i] = PEAK_MIN(w);
+		}
+	} else if(wave.avg_shift) {
+		/* Hi-res, one 16 bit mean per pixel */
 		for(U16 i = 0; i < SAMPLES_NR; ++i)
-			if(dso_scope.avg_flag)
-				wave.avg_buf[i] = wave.tmp_buf[i];
-			else 
-				wave.avg_buf[i] = (wave.avg_buf[i] + wave.tmp_buf[i]) / 2;
+			wave.avg_buf[i] = wave.peak_buf[RING_IDX(i)];
+	} else {
+		/* 10us captures half of the samples, fill the gaps with the midpoint */
+		last = (dso_scope.acq_mode == ACQ_INTERLEAVED) ? 2 * wave.ring_len - 1 : wave.ring_len - 1;
+
+		for(U16 i = 0; i < SAMPLES_NR; ++i) {
+			if(dso_scope.timebase == 10) {
+				n = i >> 1;
+				if(!(i & 1))
+					val = frame_sample(n);
+				else
+					val = (frame_sample(n) + frame_sample(n < last ? n + 1 : n)) / 2;
+			} else
+				val = frame_sample(i);
+
+			wave.avg_buf[i] = val;
+		}
 	}
 
+	/* Sub-sample trigger edge position, frame_align() lines it up. The
+	 * interleaved modes have two frame samples per ring entry, 10us another
+	 * two per sample. */
+	at = trig.pre;
+	if(dso_scope.acq_mode == ACQ_INTERLEAVED)
+		at <<= 1;
+	if(dso_scope.timebase == 10)
+		at <<= 1;
+	wave.avg_align = wave.avg_peak ? 0 : trigger_align(wave.avg_buf, at, wave.avg_shift);
+
+	/* frame_swap() hands it over to the display */
+	wave.frame_ready = 1;
+	dso_scope.done_sampling = 1;
+
+	/* The main loop marks the single shot captured, see scope_event() */
 	if(BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT))){
-		BitSet(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT));
+		dso_scope.acquiring = 0;
+		loop_post(EV_CAPTURE, CAPT_SINGLE);
 		return;
 	}
+	loop_post(EV_CAPTURE, 0);
 
-	if(dso_scope.avg_flag)
-		dso_scope.avg_flag = 0;
-
-	if(dso_scope.done_displaying || !(--dso_scope.avg_total))
-		dso_scope.done_sampling = 1;
-	else {
-		/* Start searching for a new trigger */
-		TIM3_struct.TIM_Period = 72;
-		TIM_TimeBaseInit(TIM3, &TIM3_struct);
-		TIM_SelectOutputTrigger(TIM3, TIM_TRGOSource_Update); // ADC_ExternalTrigConv_T3_TRGO
-		TIM_Cmd(TIM3, ENABLE);
-		
-		/* ADC Interrupts */
-		ADC_ITConfig(ADC1, ADC_IT_EOC , ENABLE);
-	}
-
-	/* Reset calibration sample */
-	dso_scope.prev_cal_samp = ADC_MAX;
-  }
+	/* Keep capturing while the main loop draws the front buffer */
+	trigger_search();
 }
 
 /*void TIM4_IRQHandler(void)
@@ -271,91 +274,88 @@ void TIM3_IRQHandler(void)
 	//dso_scope.done_sampling = 1;
 }
 
-void ADC1_2_IRQHandler(void)
+/* TIM2 counted the samples of the current trigger phase, see trigger.h */
+void TIM2_IRQHandler(void)
 {
-	ADC_ClearITPendingBit(ADC1, ADC_IT_EOC);
-	
-	if((ADC1->DR > (dso_scope.trig_lvl_adc + NOISE_MARGIN) && 
-			dso_scope.prev_cal_samp < dso_scope.trig_lvl_adc )) {
-	//uputs("Triggered", USART1);
-
-	/* Disable ADC Interrupts - the sampling can start now */
-	ADC_ITConfig(ADC1, ADC_IT_EOC , DISABLE);
-
-	/* Update real time counter */
-	dso_scope.rt_timer = (U16)12 * dso_scope.timebase;
-	
-	/* Reload timer with proper parameters */
-	TIM_Cmd(TIM3, DISABLE);
-	TIM3_struct.TIM_Period = timebase_pres[dso_scope.tb_i] - 1;
-	TIM_TimeBaseInit(TIM3, &TIM3_struct);
-	TIM_SelectOutputTrigger(TIM3, TIM_TRGOSource_Update); // ADC_ExternalTrigConv_T3_TRGO
-	TIM_Cmd(TIM3, ENABLE);
-	
-	/* Start averaging */
-	dso_scope.avg_flag = 1;
-	if(dso_scope.timebase == 10)
-		dso_scope.avg_total = 1;
+	TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+
+	switch(trig.state) {
+	case TRIG_PRE_FILL:
+		trigger_arm();
+		break;
+	case TRIG_ARMING:
+	case TRIG_ARMED:
+		/* Timeout (auto mode): capture whatever is on the input */
+		loop_post(EV_TRIG_TIMEOUT, 0);
+		trigger_fire();
+		break;
+	case TRIG_POST:
+		capture_done();
+		break;
+	default:
+		break;
+	}
+}
 
-	/* Enable DMA on channel 1 (ADC1) */
-	DMA_Cmd(DMA1_Channel1, ENABLE);
+/* Peak detect and hi-res: a sub_buf half holds the samples of one pixel */
+void DMA1_Channel1_IRQHandler(void)
+{
+	if(DMA_GetITStatus(DMA1_IT_HT1))
+		DMA_ClearITPendingBit(DMA1_IT_HT1);
+	else if(DMA_GetITStatus(DMA1_IT_TC1))
+		DMA_ClearITPendingBit(DMA1_IT_TC1);
+	else
+		return;
 
-	} else {
-		dso_scope.prev_cal_samp = ADC1->DR;
-		
-		/* Continue sampling in single shot mode until a trigger occurrs */
-		if(BitTest(dso_scope.btns_flags, (1 << SINGLES_BIT)))
-			return;
-
-		if(dso_scope.rt_timer) {
-			//uputs("Debugging", USART1);
-			--dso_scope.rt_timer;
-		}
-		else {
-			if(dso_scope.test_timer) {
-				--dso_scope.test_timer;
-				return;
-			}
-
-			/* Disable ADC Interrupts - the sampling can start now */
-			ADC_ITConfig(ADC1, ADC_IT_EOC , DISABLE);
-
-			//uputs("RTIMER 0\n", USART1);
-			/* Reload timer with proper parameters */
-			TIM_Cmd(TIM3, DISABLE);
-			TIM3_struct.TIM_Period = timebase_pres[dso_scope.tb_i] - 1;
-			TIM_TimeBaseInit(TIM3, &TIM3_struct);
-			TIM_SelectOutputTrigger(TIM3, TIM_TRGOSource_Update); // ADC_ExternalTrigConv_T3_TRGO
-			TIM_Cmd(TIM3, ENABLE);
-	
-			/* Start averaging */
-			dso_scope.avg_flag = 1;
-			dso_scope.avg_total = 1;
-
-			/* Enable DMA on channel 1 (ADC1) */
-			DMA_Cmd(DMA1_Channel1, ENABLE);
-		}
-	}
+	peak_reduce();
 }
 
-void USART1_IRQHandler(void)
+/* Frequency counter, a burst of TrigIn edge captures is complete */
+void DMA1_Channel2_IRQHandler(void)
 {
-  if(USART_GetITStatus(USART1, USART_IT_RXNE) != RESET) {
-	if(dso_scope.RX_flag == RESEND) {
-			UartPutc(RESEND, USART1);
+	if(!DMA_GetITStatus(DMA1_IT_TC2))
 		return;
-	}
 
-	U8 received = USART_ReceiveData(USART1);
-	dso_scope.RX_command = received;
+	DMA_ClearITPendingBit(DMA1_IT_GL2);
+	freqcnt_done();
+}
 
-	if(received == SERIAL_SEND_WF && BitTest(dso_scope.btns_flags, (1 << SS_CAPTURED_BIT)))
-		UartPutc(WF_SENDING, USART1);
-	else	
-		UartPutc(ACK, USART1);
+/* TFT pixel stream run done, see TFT_DMA_Init() */
+void DMA1_Channel7_IRQHandler(void)
+{
+	if(!DMA_GetITStatus(DMA1_IT_TC7))
+		return;
 
-	dso_scope.RX_flag = RESEND;
-  }
+	DMA_ClearITPendingBit(DMA1_IT_GL7);
+	TFT_DMA_Done();
+}
+
+/* Frequency counter timestamp overflow */
+void TIM1_UP_IRQHandler(void)
+{
+	if(!TIM_GetITStatus(TIM1, TIM_IT_Update))
+		return;
+
+	TIM_ClearITPendingBit(TIM1, TIM_IT_Update);
+	freqcnt_wrap();
+}
+
+/* Analog watchdog, see trigger.h */
+void ADC1_2_IRQHandler(void)
+{
+	if(!ADC_GetITStatus(ADC1, ADC_IT_AWD))
+		return;
+
+	ADC_ClearITPendingBit(ADC1, ADC_IT_AWD);
+
+	trigger_awd_event();
+}
+
+/* Received bytes go to the RX ring, see uart.h */
+void USART1_IRQHandler(void)
+{
+	if(USART_GetITStatus(USART1, USART_IT_RXNE) != RESET)
+		uart_rx(USART_ReceiveData(USART1));
 }
 
 /******************* (C) COPYRIGHT 2010 STMicroelectronics *****END OF FILE****/
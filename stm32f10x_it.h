@@ -40,9 +40,13 @@ void DebugMon_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
 
-void DMA1_Channel1_IRQHandler(void);
 /*void TIM4_IRQHandler(void);*/
+void TIM2_IRQHandler(void);
 void TIM3_IRQHandler(void);
+void DMA1_Channel1_IRQHandler(void);
+void DMA1_Channel2_IRQHandler(void);
+void TIM1_UP_IRQHandler(void);
+void DMA1_Channel7_IRQHandler(void);
 void ADC1_2_IRQHandler(void);
 void USART1_IRQHandler(void);
 
@@ -0,0 +1,47 @@
+#include <sys/mman.h>
+
+#include "stm32f10x.h"
+
+#include "host.h"
+
+#define HOST_PERIPH_LEN		0x30000		/* APB1, APB2 and AHB up to CRC */
+#define HOST_SYSTEM_LEN		0x10000		/* ITM, DWT, SysTick, NVIC, SCB */
+
+int host_failed;
+
+static void host_map(unsigned long base, size_t len)
+{
+	void *p = mmap((void *)base, len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if(p != (void *)base) {
+		fprintf(stderr, "can't map %#lx\n", base);
+		exit(2);
+	}
+}
+
+static void __attribute__((constructor)) host_init(void)
+{
+	host_map(PERIPH_BASE, HOST_PERIPH_LEN);
+	host_map(SCS_BASE & 0xFFFF0000, HOST_SYSTEM_LEN);
+}
+
+void host_check(int ok, const char *what, const char *file, int line)
+{
+	if(ok)
+		return;
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+	++host_failed;
+}
+
+/* USE_FULL_ASSERT is set in stm32f10x_conf.h */
+void assert_failed(uint8_t *file, uint32_t line)
+{
+	host_check(0, "assert_param", (const char *)file, line);
+}
+
+int host_result(const char *test)
+{
+	printf("%s: %s\n", test, host_failed ? "FAIL" : "ok");
+	return host_failed ? 1 : 0;
+}
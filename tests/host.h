@@ -0,0 +1,21 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+ * Host test helpers. host.c backs the peripheral and the system control
+ * address ranges with plain memory before main(), so the firmware
+ * modules and the StdPeriph drivers run unchanged.
+ */
+#define CHECK(c)	host_check((c), #c, __FILE__, __LINE__)
+
+extern int host_failed;
+
+void host_check(int ok, const char *what, const char *file, int line);
+void assert_failed(uint8_t *file, uint32_t line);
+int host_result(const char *test);
+
+#endif
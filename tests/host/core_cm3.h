@@ -0,0 +1,27 @@
+/*
+ * Host build of core_cm3.h. The register maps and the NVIC/SysTick
+ * helpers are used as they are, the Cortex-M3 instructions become no-ops.
+ */
+#ifndef HOST_CORE_CM3_H
+#define HOST_CORE_CM3_H
+
+#include <stdint.h>
+
+#define __ASM			__asm
+#define __INLINE		inline
+
+static __INLINE void __DSB(void);
+
+/* Skip the compiler specific intrinsics, they are ARM assembly */
+#pragma push_macro("__GNUC__")
+#undef __GNUC__
+#include_next "core_cm3.h"
+#pragma pop_macro("__GNUC__")
+
+static __INLINE void __enable_irq(void)		{ }
+static __INLINE void __disable_irq(void)	{ }
+static __INLINE void __NOP(void)		{ }
+static __INLINE void __WFI(void)		{ }
+static __INLINE void __DSB(void)		{ }
+
+#endif
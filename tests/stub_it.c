@@ -0,0 +1,18 @@
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * The rest of what stm32f10x_it.c calls, for tests that run the
+ * interrupt handlers. The globals come from the tests.
+ */
+uint32_t SystemCoreClock = 72000000;
+
+__IO TIM_TimeBaseInitTypeDef TIM3_struct;
+
+void TFT_DMA_Done(void) { }
+void btn_tick(void) { }
+void freqcnt_done(void) { }
+void freqcnt_wrap(void) { }
+void trigger_search(void) { }
+void uart_rx(U8 b) { }
@@ -0,0 +1,125 @@
+#include <math.h>
+
+#include "stm32f10x.h"
+
+#include "avg.h"
+#include "scope.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Boxcar and exponential averaging against a double precision reference,
+ * for every N and for 12 bit and hi-res 16 bit samples.
+ */
+#define ADC_TOP		4095
+#define HIRES_TOP	65520		/* 4095 << HIRES_SHIFT */
+#define EXP_TOL		1.5		/* Truncation of acc / N, plus the rounding */
+
+extern struct averager avg;
+
+static U16 frame[SAMPLES_NR];
+static double sum[SAMPLES_NR], mean[SAMPLES_NR], ref[SAMPLES_NR];
+
+/* Noise around a ramp, so every sample has its own average */
+static void next_frame(U16 top)
+{
+	U16 i;
+	S32 v;
+
+	for(i = 0; i < SAMPLES_NR; ++i) {
+		v = (S32)top * i / SAMPLES_NR + rand() % (top / 8) - top / 16;
+		frame[i] = (v < 0) ? 0 : (v > top) ? top : v;
+	}
+}
+
+static void test_boxcar(U8 mode_i, U16 top)
+{
+	U32 n = 1UL << AVG_SHIFT(mode_i), k, frames = 3 * n + n / 2 + 1;
+	U8 full = 0;
+	U16 i;
+	double worst = 0;
+
+	avg_config(mode_i);
+	for(k = 1; k <= frames; ++k) {
+		next_frame(top);
+		for(i = 0; i < SAMPLES_NR; ++i) {
+			sum[i] = ((k - 1) % n ? sum[i] : 0) + frame[i];
+			if(k % n == 0)
+				mean[i] = sum[i] / n;
+			/* The last complete block, the running mean before the first */
+			ref[i] = full || k % n == 0 ? mean[i] : sum[i] / ((k - 1) % n + 1);
+		}
+		if(k % n == 0)
+			full = 1;
+
+		avg_frame(frame);
+		for(i = 0; i < SAMPLES_NR; ++i)
+			if(fabs(frame[i] - ref[i]) > worst)
+				worst = fabs(frame[i] - ref[i]);
+	}
+	CHECK(worst <= 0.5);
+}
+
+static void test_exponential(U8 mode_i, U16 top)
+{
+	U32 n = 1UL << AVG_SHIFT(mode_i), k, frames = 8 * n + 10;
+	U16 i;
+	double worst = 0;
+
+	avg_config(mode_i);
+	for(k = 0; k < frames; ++k) {
+		next_frame(top);
+		for(i = 0; i < SAMPLES_NR; ++i)
+			ref[i] = k ? ref[i] + (frame[i] - ref[i]) / n : frame[i];
+
+		avg_frame(frame);
+		for(i = 0; i < SAMPLES_NR; ++i)
+			if(fabs(frame[i] - ref[i]) > worst)
+				worst = fabs(frame[i] - ref[i]);
+	}
+	CHECK(worst <= EXP_TOL);
+}
+
+/* A reset drops the old frames, the first frame comes back as it is */
+static void test_reset(void)
+{
+	U16 i, first[SAMPLES_NR];
+
+	avg_config(AVG_SHIFTS_NR);
+	for(i = 0; i < 5; ++i) {
+		next_frame(ADC_TOP);
+		avg_frame(frame);
+	}
+
+	avg_reset();
+	next_frame(ADC_TOP);
+	for(i = 0; i < SAMPLES_NR; ++i)
+		first[i] = frame[i];
+	avg_frame(frame);
+	for(i = 0; i < SAMPLES_NR; ++i)
+		CHECK(frame[i] == first[i]);
+
+	/* Off leaves the frame alone */
+	avg_config(0);
+	next_frame(HIRES_TOP);
+	for(i = 0; i < SAMPLES_NR; ++i)
+		first[i] = frame[i];
+	avg_frame(frame);
+	for(i = 0; i < SAMPLES_NR; ++i)
+		CHECK(frame[i] == first[i]);
+}
+
+int main(void)
+{
+	U8 i;
+
+	srand(5);
+	for(i = 1; i <= AVG_SHIFTS_NR; ++i) {
+		test_boxcar(i, ADC_TOP);
+		test_boxcar(i, HIRES_TOP);
+		test_exponential(AVG_SHIFTS_NR + i, ADC_TOP);
+		test_exponential(AVG_SHIFTS_NR + i, HIRES_TOP);
+	}
+	test_reset();
+	return host_result("avg");
+}
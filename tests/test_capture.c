@@ -0,0 +1,157 @@
+#include "stm32f10x.h"
+
+#include "scope.h"
+#include "trigger.h"
+#include "peak.h"
+#include "stm32f10x_it.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Unroll captured rings through capture_done() (run from TIM2_IRQHandler()
+ * in TRIG_POST) and check the frame against the samples that were stored,
+ * in the single ADC and the fast interleaved modes. The decimated modes
+ * fill their ring through the sub_buf DMA interrupt and peak_reduce().
+ */
+extern struct trigger trig;
+extern struct peak peak;
+
+__IO DMA_InitTypeDef DMA_struct;
+__IO struct scope dso_scope;
+__IO struct waveform wave;
+
+static U16 back[SAMPLES_NR], back_min[SAMPLES_NR];
+
+/* Distinct, not monotonic sample values */
+static U16 sample(U16 s)
+{
+	return 100 + (s * 37) % 3900;
+}
+
+/* Capture ending with the frame starting at ring entry [start] */
+static void capture(U8 mode, U32 timebase, U16 ring_len, U16 start)
+{
+	U16 pre = TRIG_PRE(ring_len, 50), e, l;
+
+	dso_scope.acq_mode = mode;
+	dso_scope.timebase = timebase;
+	dso_scope.btns_flags = 0;
+	wave.ring_len = ring_len;
+	wave.avg_buf = back;
+	wave.avg_min = back_min;
+
+	/* Entry [start] holds the first frame sample(s), see decimate() */
+	for(e = 0; e < ring_len && !ACQ_DECIMATED(mode); ++e) {
+		l = (e + ring_len - start) % ring_len;
+		if(mode == ACQ_INTERLEAVED)
+			wave.pair_buf[e] = ((U32)sample(2 * l) << 16) | sample(2 * l + 1);
+		else
+			wave.tmp_buf[e] = sample(l);
+	}
+
+	trig.pre = pre;
+	trig.index = (start + pre) % ring_len;
+	trig.level = ADC_MAX;
+	trig.state = TRIG_POST;
+	TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+	TIM2_IRQHandler();
+
+	CHECK(wave.start == start);
+	CHECK(wave.frame_ready);
+	CHECK(wave.avg_peak == (mode == ACQ_PEAK));
+	CHECK(wave.avg_shift == ((mode == ACQ_HIRES) ? HIRES_SHIFT : 0));
+}
+
+/* Pixel [l] of the frame starting at ring entry [start], one sub_buf half each */
+static void decimate(U8 mode, U16 decim, U16 start)
+{
+	U16 l, i;
+	U8 half;
+
+	dso_scope.acq_mode = mode;
+	wave.ring_len = SAMPLES_NR;
+	peak_start(decim);
+	peak.pos = start;
+
+	for(l = 0; l < SAMPLES_NR; ++l) {
+		half = l & 1;
+		for(i = 0; i < decim; ++i)
+			peak.sub_buf[half * decim + i] = sample(l) + i % 3;
+		/* The interrupt flag of the half that completed */
+		DMA1->ISR = half ? DMA1_IT_TC1 : DMA1_IT_HT1;
+		DMA1_Channel1_IRQHandler();
+		DMA1->ISR = 0;
+	}
+}
+
+static void test_decimated(void)
+{
+	U16 start, i, bad;
+
+	for(start = 0; start < SAMPLES_NR; start += 53) {
+		decimate(ACQ_PEAK, 12, start);
+		capture(ACQ_PEAK, 5000, SAMPLES_NR, start);
+		for(i = bad = 0; i < SAMPLES_NR; ++i)
+			bad += back[i] != sample(i) + 2 || back_min[i] != sample(i);
+		CHECK(!bad);
+
+		/* The mean of 4 x (s, s + 1, s + 2) is s + 1 */
+		decimate(ACQ_HIRES, 12, start);
+		capture(ACQ_HIRES, 5000, SAMPLES_NR, start);
+		for(i = bad = 0; i < SAMPLES_NR; ++i)
+			bad += back[i] != (sample(i) + 1) << HIRES_SHIFT;
+		CHECK(!bad);
+	}
+}
+
+static void test_single(void)
+{
+	U16 start, i, bad;
+
+	for(start = 0; start < SAMPLES_NR; start += 37) {
+		capture(ACQ_SINGLE, 50, SAMPLES_NR, start);
+		for(i = bad = 0; i < SAMPLES_NR; ++i)
+			bad += back[i] != sample(i);
+		CHECK(!bad);
+	}
+}
+
+/* 20us: ADC2 then ADC1 of every entry, 300 real samples */
+static void test_interleaved(void)
+{
+	U16 start, i, bad;
+
+	for(start = 0; start < SAMPLES_NR / 2; start += 19) {
+		capture(ACQ_INTERLEAVED, 20, SAMPLES_NR / 2, start);
+		for(i = bad = 0; i < SAMPLES_NR; ++i)
+			bad += back[i] != sample(i);
+		CHECK(!bad);
+	}
+}
+
+/* 10us: 150 real samples, midpoints in between, the last one repeated */
+static void test_interleaved_10us(void)
+{
+	U16 start, i, n, last = SAMPLES_NR / 2 - 1, bad;
+
+	for(start = 0; start < SAMPLES_NR / 4; start += 11) {
+		capture(ACQ_INTERLEAVED, 10, SAMPLES_NR / 4, start);
+		for(i = bad = 0; i < SAMPLES_NR; ++i) {
+			n = i >> 1;
+			if(i & 1)
+				bad += back[i] != (sample(n) + sample(n < last ? n + 1 : n)) / 2;
+			else
+				bad += back[i] != sample(n);
+		}
+		CHECK(!bad);
+	}
+}
+
+int main(void)
+{
+	test_single();
+	test_interleaved();
+	test_interleaved_10us();
+	test_decimated();
+	return host_result("capture");
+}
@@ -0,0 +1,158 @@
+#include <math.h>
+
+#include "stm32f10x.h"
+
+#include "fft.h"
+#include "scope.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Compare the Q15 spectrum with a double precision DFT of the same frame:
+ * mean removed, the same window, dB below a full swing sine corrected by
+ * the coherent gain of the window.
+ */
+#define RATE_HZ		(1e6 * SAMPLES_NR / TB_DIVS / TIMEBASE_US)
+#define TIMEBASE_US	1000
+#define STRONG_DB	(-30.0)		/* Bins above are compared closely */
+#define STRONG_TOL	0.5
+#define LEAK_DB		(-45.0)		/* Leakage is near the Q15 rounding noise */
+#define LEAK_TOL	2.0
+#define WEAK_DB		(-70.0)		/* Bins below have to stay near the noise floor */
+#define WEAK_MAX	(-45.0)
+
+__IO struct scope dso_scope;
+struct waveform wave;
+
+static U16 frame[SAMPLES_NR];
+static double ref[FFT_BINS];
+
+void render_invalidate(void)
+{
+}
+
+static double window(U8 w, U16 n)
+{
+	double t = 2 * M_PI * n / FFT_N;
+
+	if(w == FFT_HANN)
+		return 0.5 - 0.5 * cos(t);
+	return 0.21557895 - 0.41663158 * cos(t) + 0.277263158 * cos(2 * t)
+		- 0.083578947 * cos(3 * t) + 0.006947368 * cos(4 * t);
+}
+
+static void ref_dft(U8 w)
+{
+	double mean = 0, gain = 0, re, im, x;
+	U16 n, k;
+
+	for(n = 0; n < FFT_N; ++n) {
+		mean += frame[n];
+		gain += window(w, n);
+	}
+	mean /= FFT_N;
+	gain /= FFT_N;
+
+	for(k = 0; k < FFT_BINS; ++k) {
+		re = im = 0;
+		for(n = 0; n < FFT_N; ++n) {
+			x = (frame[n] - mean) * window(w, n);
+			re += x * cos(2 * M_PI * k * n / FFT_N);
+			im -= x * sin(2 * M_PI * k * n / FFT_N);
+		}
+		/* A full swing sine has 2048 / 2 in its bin */
+		x = hypot(re, im) / FFT_N / gain / 1024;
+		ref[k] = (x > 0) ? 20 * log10(x) : -200;
+	}
+}
+
+/* Run both, compare bin by bin, return the Q15 peak frequency in Hz */
+static double compare(U8 w)
+{
+	double q;
+	U16 k, ref_peak = 3;
+
+	fft_config(w);
+	fft_frame();
+	ref_dft(w);
+
+	/* DC and its leakage are skipped, as by the peak search */
+	for(k = 3; k < FFT_BINS; ++k) {
+		q = fft.db[k] / 256.0;
+		if(ref[k] > STRONG_DB)
+			CHECK(fabs(q - ref[k]) < STRONG_TOL);
+		else if(ref[k] > LEAK_DB)
+			CHECK(fabs(q - ref[k]) < LEAK_TOL);
+		if(ref[k] < WEAK_DB)
+			CHECK(q < WEAK_MAX);
+		if(ref[k] > ref[ref_peak])
+			ref_peak = k;
+	}
+	/* Bins tied within rounding can go either way */
+	CHECK(ref[fft.peak] > ref[ref_peak] - 0.5);
+	return fft_peak_mhz() / 1000.0;
+}
+
+static void sine(double bin, double amp)
+{
+	U16 i;
+
+	for(i = 0; i < SAMPLES_NR; ++i)
+		frame[i] = lround(2048 + amp * sin(2 * M_PI * bin * i / FFT_N + 0.3));
+}
+
+/* On a bin, between bins, small and full swing */
+static void test_sine(void)
+{
+	static const double bins[] = { 20, 20.37, 37.3, 61.8 };
+	/* The parabola is a poor fit for the flat top */
+	static const double bin_tol[FFT_WINDOWS_NR] = { 0.1, 0.5 };
+	double f, hz;
+	U8 w, i;
+
+	for(w = 0; w < FFT_WINDOWS_NR; ++w)
+		for(i = 0; i < sizeof(bins) / sizeof(bins[0]); ++i) {
+			sine(bins[i], 2047);
+			f = bins[i] * RATE_HZ / FFT_N;
+			hz = compare(w);
+			CHECK(fabs(hz - f) < bin_tol[w] * RATE_HZ / FFT_N);
+			CHECK(fabs(fft.db[fft.peak] / 256.0 - ref[fft.peak]) < 0.5);
+
+			sine(bins[i], 200);
+			compare(w);
+		}
+
+	/* Full swing on a bin reads 0 dB with either window */
+	sine(32, 2047.5);
+	fft_config(FFT_HANN);
+	fft_frame();
+	CHECK(fabs(fft.db[32] / 256.0) < 0.5);
+	fft_config(FFT_FLATTOP);
+	fft_frame();
+	CHECK(fabs(fft.db[32] / 256.0) < 0.5);
+}
+
+/* Odd harmonics at 1/n */
+static void test_square(void)
+{
+	U16 i;
+	U8 w;
+
+	for(i = 0; i < SAMPLES_NR; ++i)
+		frame[i] = (i % 32 < 16) ? 800 : 3200;
+
+	for(w = 0; w < FFT_WINDOWS_NR; ++w) {
+		compare(w);
+		CHECK(fft.peak == FFT_N / 32);
+	}
+}
+
+int main(void)
+{
+	wave.display_buf = frame;
+	dso_scope.timebase = TIMEBASE_US;
+
+	test_sine();
+	test_square();
+	return host_result("fft");
+}
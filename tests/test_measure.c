@@ -0,0 +1,165 @@
+#include <math.h>
+
+#include "stm32f10x.h"
+
+#include "measure.h"
+#include "scope.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Measurements on synthetic frames against their analytic values. Edges
+ * use the thresholds of the previous frame, so every frame is measured
+ * twice.
+ */
+#define TIMEBASE_US	1000
+#define SAMPLE_NS	(1000.0 * TIMEBASE_US * TB_DIVS / SAMPLES_NR)
+
+__IO struct scope dso_scope;
+struct waveform wave;
+
+static U16 frame[SAMPLES_NR];
+static U16 frame_min[SAMPLES_NR];
+
+static void measure(void)
+{
+	meas.hi = 0;
+	meas_frame();
+	meas_frame();
+}
+
+static double samples(U32 t)
+{
+	return (double)t / MEAS_FRAC;
+}
+
+static double rms(void)
+{
+	double s = 0;
+	U16 i;
+
+	for(i = 0; i < SAMPLES_NR; ++i)
+		s += (double)frame[i] * frame[i];
+	return sqrt(s / SAMPLES_NR);
+}
+
+/* Period [p] samples, non-integer so the crossings fall between samples */
+static void test_sine(void)
+{
+	static const double periods[] = { 23.7, 37.3, 71.9 };
+	double p, f;
+	U16 i;
+	U8 k;
+
+	for(k = 0; k < sizeof(periods) / sizeof(periods[0]); ++k) {
+		p = periods[k];
+		for(i = 0; i < SAMPLES_NR; ++i)
+			frame[i] = lround(2000 + 1500 * sin(2 * M_PI * i / p + 0.4));
+		measure();
+
+		CHECK(abs(meas.min - 500) <= 2);
+		CHECK(abs(meas.max - 3500) <= 2);
+		CHECK(abs(meas.rms - lround(rms())) <= 1);
+		CHECK(meas.edges >= (U8)(SAMPLES_NR / p) - 1);
+		CHECK(fabs(samples(meas.period) - p) < 0.05);
+		CHECK(abs(meas.duty - 500) <= 10);
+		/* 10 to 90 % of a sine, asin(0.8) on either side of the middle */
+		f = p * asin(0.8) / M_PI;
+		CHECK(fabs(samples(meas.rise) - f) < 0.1 * f);
+		CHECK(fabs(samples(meas.fall) - f) < 0.1 * f);
+
+		f = 1e12 / (p * SAMPLE_NS);
+		CHECK(fabs(meas_freq_mhz() - f) < 0.005 * f);
+	}
+}
+
+/* 30 % duty, linear edges [ramp] samples long */
+static void square(U16 period, U16 ramp)
+{
+	U16 i, t, high = period * 3 / 10;
+
+	for(i = 0; i < SAMPLES_NR; ++i) {
+		t = (i + period - 5) % period;
+		if(t < ramp)
+			frame[i] = 400 + 3000 * t / ramp;
+		else if(t < high)
+			frame[i] = 3400;
+		else if(t < high + ramp)
+			frame[i] = 3400 - 3000 * (t - high) / ramp;
+		else
+			frame[i] = 400;
+	}
+}
+
+static void test_square(void)
+{
+	U16 ramp;
+
+	for(ramp = 1; ramp <= 10; ramp += 3) {
+		square(50, ramp);
+		measure();
+
+		CHECK(meas.min == 400);
+		CHECK(meas.max == 3400);
+		CHECK(abs(meas.rms - lround(rms())) <= 1);
+		CHECK(meas.edges == SAMPLES_NR / 50);
+		CHECK(meas.period == 50 * MEAS_FRAC);
+		/* The middle of the edges is 15 samples apart */
+		CHECK(abs(meas.duty - 300) <= 3);
+		if(ramp > 1) {
+			CHECK(fabs(samples(meas.rise) - 0.8 * ramp) < 0.05 * ramp);
+			CHECK(fabs(samples(meas.fall) - 0.8 * ramp) < 0.05 * ramp);
+		}
+		CHECK(meas_time_ns(meas.period) == lround(50 * SAMPLE_NS));
+	}
+}
+
+/* Below MEAS_MIN_SWING there are no edges, only levels */
+static void test_flat(void)
+{
+	U16 i;
+
+	for(i = 0; i < SAMPLES_NR; ++i)
+		frame[i] = 1000 + (i & 1) * (MEAS_MIN_SWING - 1);
+	measure();
+
+	CHECK(meas.hi == 0);
+	CHECK(meas.edges == 0);
+	CHECK(meas.period == 0);
+	CHECK(meas_freq_mhz() == 0);
+	CHECK(meas.avg == 1000 + (MEAS_MIN_SWING - 1) / 2 + 1);
+}
+
+/* Peak detect frames measure the middle of each min/max pair */
+static void test_peak(void)
+{
+	U16 i;
+
+	square(60, 4);
+	for(i = 0; i < SAMPLES_NR; ++i) {
+		frame_min[i] = frame[i] - 200;
+		frame[i] += 200;
+	}
+	wave.display_peak = 1;
+	measure();
+	wave.display_peak = 0;
+
+	CHECK(meas.min == 200);
+	CHECK(meas.max == 3600);
+	CHECK(meas.period == 60 * MEAS_FRAC);
+	CHECK(abs(meas.duty - 300) <= 3);
+}
+
+int main(void)
+{
+	wave.display_buf = frame;
+	wave.display_min = frame_min;
+	wave.display_shift = 0;
+	dso_scope.timebase = TIMEBASE_US;
+
+	test_sine();
+	test_square();
+	test_flat();
+	test_peak();
+	return host_result("measure");
+}
@@ -0,0 +1,92 @@
+#include <math.h>
+
+#include "stm32f10x.h"
+
+#include "peak.h"
+#include "scope.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Peak detect and hi-res reduction with the sub_buf DMA replayed one
+ * conversion at a time: the half and transfer complete interrupts call
+ * peak_reduce(), the watchdog may ask peak_index() for the pixel of the
+ * last conversion before or after them.
+ */
+#define PIXELS		(3 * SAMPLES_NR / 2)	/* The frame ring wraps */
+#define RING		SAMPLES_NR
+
+extern struct peak peak;
+
+__IO struct scope dso_scope;
+struct waveform wave;
+
+static U16 samples[PEAK_DECIM_MAX];
+
+/* Noise with a one sample glitch up and down somewhere in the pixel */
+static void pixel_samples(U16 decim, U16 p)
+{
+	U16 i;
+
+	for(i = 0; i < decim; ++i)
+		samples[i] = 1000 + rand() % 2000;
+	samples[(p * 7) % decim] = 4095;
+	samples[(p * 13 + 1) % decim] = 3 + p % 5;
+}
+
+static void test_decim(U16 decim, U8 mode)
+{
+	U16 p, i, max, min, cndtr = 0;
+	U32 pos = 0, w;
+	double mean;
+
+	dso_scope.acq_mode = mode;
+	wave.ring_len = RING;
+	peak_start(decim);
+
+	for(p = 0; p < PIXELS; ++p) {
+		pixel_samples(decim, p);
+		max = 0;
+		min = 0xFFFF;
+		mean = 0;
+		for(i = 0; i < decim; ++i) {
+			peak.sub_buf[pos] = samples[i];
+			pos = (pos + 1) % (2 * decim);
+			cndtr = 2 * decim - pos;
+			CHECK(peak_index(cndtr) == p % RING);
+
+			if(samples[i] > max)
+				max = samples[i];
+			if(samples[i] < min)
+				min = samples[i];
+			mean += samples[i];
+		}
+
+		/* The half is complete, the watchdog can come after the interrupt */
+		peak_reduce();
+		CHECK(peak_index(cndtr) == p % RING);
+		CHECK(peak.pos == (p + 1) % RING);
+
+		w = wave.peak_buf[p % RING];
+		if(mode == ACQ_HIRES) {
+			mean = mean * (1 << HIRES_SHIFT) / decim;
+			CHECK(fabs(w - mean) <= 0.5);
+		} else {
+			CHECK(PEAK_MAX(w) == max);
+			CHECK(PEAK_MIN(w) == min);
+		}
+	}
+}
+
+int main(void)
+{
+	static const U16 decims[] = { PEAK_DECIM_MIN, 5, 37, 100, PEAK_DECIM_MAX };
+	U8 i;
+
+	srand(7);
+	for(i = 0; i < sizeof(decims) / sizeof(decims[0]); ++i) {
+		test_decim(decims[i], ACQ_PEAK);
+		test_decim(decims[i], ACQ_HIRES);
+	}
+	return host_result("peak");
+}
@@ -0,0 +1,198 @@
+#include <math.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "render.h"
+#include "peak.h"
+#include "scope.h"
+#include "Screen.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Run frames through the column-diff renderer on a host framebuffer.
+ * Every incremental frame has to leave the same pixels as a full repaint,
+ * and the pixels sent over the bus are counted against what the old
+ * waveform_display() wrote: the band clear, the grid and a rect per sample.
+ */
+#define FRAMES_NR	64
+
+extern struct render render;
+
+__IO struct scope dso_scope;
+struct waveform wave;
+
+static U8 font[256 * 16];
+FONT ASC8X16 = { font, 8, 16, 8, 16, 0 };
+
+static U16 fb[ScreenYsize][ScreenXsize];
+static U16 frame[SAMPLES_NR], frame_min[SAMPLES_NR];
+static U32 writes;
+static U16 span_x, span_y, span_n;
+
+void VSpanBegin(U16 x, U16 y, U16 ysize)
+{
+	CHECK(x >= WD_OFFSETX && x < WD_OFFSETX + WD_WIDTH);
+	CHECK(y >= WD_OFFSETY && y + ysize <= WD_OFFSETY + WD_HEIGHT);
+	span_x = x;
+	span_y = y;
+	span_n = ysize;
+}
+
+void VSpanPut(U16 color, U16 n)
+{
+	CHECK(n <= span_n);
+	span_n -= n;
+	writes += n;
+	while(n--)
+		fb[span_y++][span_x] = color;
+}
+
+void VSpanEnd(void)
+{
+	CHECK(!span_n);
+}
+
+/* Bus pixels of the old waveform_display() for the current frame */
+static U32 old_writes(void)
+{
+	U16 i, max = 0, min = ADC_MAX, x;
+	S16 cur, prev, diff;
+	U32 n;
+
+	for(i = 0; i < SAMPLES_NR; ++i) {
+		x = frame[i];
+		if(x > max)
+			max = x;
+		if(x < min)
+			min = x;
+	}
+
+	/* Band clear and grid */
+	n = (U32)WD_WIDTH * (GET_SAMPLE(max - min) + 3 + 20);
+	n += (WD_WIDTH / GRID_DIST + 1) * WD_HEIGHT + (WD_HEIGHT / GRID_DIST + 1) * WD_WIDTH;
+
+	/* Rect per sample */
+	prev = GET_SAMPLE(frame[0]);
+	n += 4;
+	for(i = 1; i < SAMPLES_NR; ++i) {
+		cur = GET_SAMPLE(frame[i]);
+		diff = cur - prev;
+		if((diff > 1 && diff <= WD_HEIGHT / 2) || (diff < -1 && diff >= -(WD_HEIGHT / 2)))
+			n += 2 * (2 + abs(diff));
+		else
+			n += 4;
+		prev = cur;
+	}
+	return n;
+}
+
+/* Render the frame, then check a full repaint changes nothing */
+static U32 render_check(void)
+{
+	static U16 copy[ScreenYsize][ScreenXsize];
+	U32 n;
+
+	writes = 0;
+	render_frame();
+	n = writes;
+
+	memcpy(copy, fb, sizeof(fb));
+	render_invalidate();
+	render_frame();
+	CHECK(writes == n + WD_WIDTH * WD_HEIGHT);
+	CHECK(!memcmp(copy, fb, sizeof(fb)));
+	return n;
+}
+
+static void sine_frame(double phase, double amp, U8 noise)
+{
+	U16 i;
+
+	for(i = 0; i < SAMPLES_NR; ++i)
+		frame[i] = lround(2048 + amp * sin(2 * M_PI * (i / 75.0 + phase))) + (noise ? rand() % noise : 0);
+}
+
+/* A drifting, slightly noisy sine: a few pixels per column instead of a redraw */
+static void test_sine(void)
+{
+	U32 n, sum = 0, old = 0;
+	U16 f;
+
+	srand(3);
+	sine_frame(0, 1200, 0);
+	render_invalidate();
+	render_frame();
+
+	for(f = 0; f < FRAMES_NR; ++f) {
+		sine_frame(f * 0.002, 1200, 8);
+		n = render_check();
+		sum += n;
+		old += old_writes();
+	}
+	printf("render: sine %u pixels per frame, was %u\n", sum / FRAMES_NR, old / FRAMES_NR);
+	CHECK(sum * 4 < old);
+
+	/* Same frame again, nothing to send */
+	writes = 0;
+	render_frame();
+	CHECK(!writes);
+}
+
+/* Edges moving over the screen, and frames that change completely */
+static void test_square(void)
+{
+	U16 f, i;
+
+	for(f = 0; f < FRAMES_NR; ++f) {
+		for(i = 0; i < SAMPLES_NR; ++i)
+			frame[i] = ((i + 3 * f) % 50 < 25) ? 600 : 3400;
+		render_check();
+	}
+
+	srand(4);
+	for(f = 0; f < 8; ++f) {
+		for(i = 0; i < SAMPLES_NR; ++i)
+			frame[i] = rand() % (ADC_MAX + 1);
+		render_check();
+	}
+}
+
+/* Peak detect bars, hi-res fraction bits */
+static void test_modes(void)
+{
+	U16 f, i;
+
+	wave.display_peak = 1;
+	for(f = 0; f < 8; ++f) {
+		sine_frame(f * 0.01, 1500, 0);
+		for(i = 0; i < SAMPLES_NR; ++i) {
+			frame_min[i] = frame[i] - 100 - 20 * f;
+			frame[i] += 100;
+		}
+		render_check();
+	}
+	wave.display_peak = 0;
+
+	wave.display_shift = HIRES_SHIFT;
+	for(f = 0; f < 8; ++f) {
+		sine_frame(f * 0.01, 1500, 0);
+		for(i = 0; i < SAMPLES_NR; ++i)
+			frame[i] <<= HIRES_SHIFT;
+		render_check();
+	}
+	wave.display_shift = 0;
+}
+
+int main(void)
+{
+	wave.display_buf = frame;
+	wave.display_min = frame_min;
+	wave.midpoint = WD_MIDY;
+
+	test_sine();
+	test_square();
+	test_modes();
+	return host_result("render");
+}
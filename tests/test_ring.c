@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "stm32f10x.h"
+
+#include "loop.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * The event ring with a real producer and consumer: one thread posts a
+ * numbered stream as fast as it can, retrying when the ring is full, the
+ * other takes it and checks that nothing is lost, doubled or reordered.
+ * Like the Cortex-M3, x86 keeps the order of the volatile stores, which
+ * is all the ring relies on.
+ *
+ * On a single core the threads rarely switch inside loop_get(), so the
+ * stream is also posted from a timer signal, which like the interrupts
+ * on the scope cuts into the consumer anywhere and fills the ring.
+ */
+#define EVENTS		2000000		/* Sequence numbers wrap at 16 bits */
+#define RUNS		4
+#define SIGNAL_US	20		/* Timer signal interval */
+#define SIGNAL_EVENTS	2000000
+
+extern struct loop loop;
+
+uint32_t SystemCoreClock = 72000000;
+
+static U32 full;
+static volatile U32 posted;
+
+static void *producer(void *unused)
+{
+	U32 i;
+
+	for(i = 0; i < EVENTS; ++i) {
+		/* Sequence number in type and arg */
+		while(!loop_post((U8)(i >> 8), (U8)i)) {
+			++full;
+			sched_yield();
+		}
+		/* Now and then let the consumer drain the ring */
+		if(!(i & 0xFFF))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void test_stream(void)
+{
+	pthread_t t;
+	struct event ev;
+	U32 i, bad = 0;
+
+	loop_config();
+	full = 0;
+	CHECK(pthread_create(&t, NULL, producer, NULL) == 0);
+
+	for(i = 0; i < EVENTS; ) {
+		if(!loop_get(&ev)) {
+			sched_yield();
+			continue;
+		}
+		if(ev.type != (U8)(i >> 8) || ev.arg != (U8)i)
+			++bad;
+		++i;
+	}
+
+	pthread_join(t, NULL);
+	CHECK(bad == 0);
+	CHECK(!loop_get(&ev));
+	CHECK(loop.lost == (U8)full);
+}
+
+/* Post until the ring is full, as a burst of interrupts would */
+static void on_alarm(int sig)
+{
+	while(posted < SIGNAL_EVENTS) {
+		if(!loop_post((U8)(posted >> 8), (U8)posted)) {
+			++full;
+			return;
+		}
+		++posted;
+	}
+}
+
+static void test_signal(void)
+{
+	struct itimerval it = { { 0, SIGNAL_US }, { 0, SIGNAL_US } };
+	struct itimerval off = { { 0, 0 }, { 0, 0 } };
+	struct event ev;
+	U32 i, bad = 0;
+	volatile U32 work;
+
+	loop_config();
+	full = posted = 0;
+	signal(SIGALRM, on_alarm);
+	setitimer(ITIMER_REAL, &it, NULL);
+
+	for(i = 0; i < SIGNAL_EVENTS; ) {
+		if(!loop_get(&ev))
+			continue;
+		if(ev.type != (U8)(i >> 8) || ev.arg != (U8)i)
+			++bad;
+		++i;
+		/* Handle it, slower than the posts so the ring stays full */
+		for(work = 0; work < 100; ++work)
+			;
+	}
+
+	setitimer(ITIMER_REAL, &off, NULL);
+	signal(SIGALRM, SIG_DFL);
+	CHECK(bad == 0);
+	CHECK(full > 0);
+	CHECK(loop.lost == (U8)full);
+}
+
+/* Single threaded edges: empty, full and the 8 bit index wrap */
+static void test_edges(void)
+{
+	struct event ev;
+	U16 i, n;
+
+	loop_config();
+	CHECK(!loop_get(&ev));
+
+	for(n = 0; n < 300; ++n) {
+		for(i = 0; i < LOOP_EVENTS_NR; ++i)
+			CHECK(loop_post(EV_SERIAL, i));
+		CHECK(!loop_post(EV_SERIAL, 0xFF));
+
+		for(i = 0; i < LOOP_EVENTS_NR; ++i) {
+			CHECK(loop_get(&ev));
+			CHECK(ev.type == EV_SERIAL && ev.arg == i);
+		}
+		CHECK(!loop_get(&ev));
+
+		/* Move the indexes off the ring boundary */
+		CHECK(loop_post(EV_FRAME, 0));
+		CHECK(loop_get(&ev));
+	}
+	CHECK(loop.lost == (U8)300);
+}
+
+int main(void)
+{
+	U8 i;
+
+	test_edges();
+	for(i = 0; i < RUNS; ++i)
+		test_stream();
+	test_signal();
+	return host_result("ring");
+}
@@ -0,0 +1,100 @@
+#include "stm32f10x.h"
+
+#include "sched.h"
+#include "loop.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Frame budget skips with the cycle counter set by hand: one decision a
+ * frame, however often the loop wakes up in it.
+ */
+extern struct sched sched;
+extern struct loop loop;
+
+uint32_t SystemCoreClock = 72000000;
+
+static U16 runs[TASKS_NR];
+static U32 trace_cycles;
+
+static void acquire(void)
+{
+	++runs[TASK_ACQUIRE];
+	sched_frame();
+	sched_ready(TASK_TRACE);
+	sched_ready(TASK_INFO);
+}
+
+static void trace(void)
+{
+	++runs[TASK_TRACE];
+	DWT_CYCCNT += trace_cycles;
+}
+
+static void info(void)
+{
+	++runs[TASK_INFO];
+}
+
+static void ui(void)
+{
+	++runs[TASK_UI];
+}
+
+/* A frame whose trace ends [over] cycles past the budget, then [wakeups] events */
+static void frame(S32 over, U8 wakeups)
+{
+	trace_cycles = SCHED_BUDGET + over;
+	sched_ready(TASK_ACQUIRE);
+	sched_run();
+
+	while(wakeups--) {
+		DWT_CYCCNT += SCHED_BUDGET;
+		sched_ready(TASK_UI);
+		sched_run();
+	}
+}
+
+static void test_skips(void)
+{
+	U8 i;
+
+	sched_config();
+	sched_add(TASK_ACQUIRE, acquire, 0);
+	sched_add(TASK_UI, ui, 0);
+	sched_add(TASK_TRACE, trace, 0);
+	sched_add(TASK_INFO, info, SCHED_INFO_SKIPS);
+
+	/* Within the budget everything runs */
+	frame(-1, 0);
+	CHECK(runs[TASK_INFO] == 1);
+	CHECK(sched.tasks[TASK_INFO].skips == 0);
+
+	/* Over it, skipped once a frame despite the wakeups */
+	for(i = 1; i <= SCHED_INFO_SKIPS; ++i) {
+		frame(1, 10);
+		CHECK(runs[TASK_INFO] == 1);
+		CHECK(sched.tasks[TASK_INFO].skipped == i);
+		CHECK(sched.tasks[TASK_INFO].ready);
+	}
+	CHECK(runs[TASK_UI] == SCHED_INFO_SKIPS * 10);
+
+	/* The limit lets it through, then skips start over */
+	frame(1, 0);
+	CHECK(runs[TASK_INFO] == 2);
+	CHECK(sched.tasks[TASK_INFO].skipped == 0);
+	frame(1, 0);
+	CHECK(runs[TASK_INFO] == 2);
+	CHECK(sched.tasks[TASK_INFO].skips == SCHED_INFO_SKIPS + 1);
+
+	/* A frame within the budget runs the one left over */
+	frame(-1, 0);
+	CHECK(runs[TASK_INFO] == 3);
+	CHECK(runs[TASK_TRACE] == SCHED_INFO_SKIPS + 4);
+}
+
+int main(void)
+{
+	test_skips();
+	return host_result("sched");
+}
@@ -0,0 +1,256 @@
+#include <math.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+
+#include "trigger.h"
+#include "scope.h"
+#include "measure.h"
+#include "Common.h"
+#include "host.h"
+
+/*
+ * Replay sample streams through the analog watchdog trigger and compare
+ * the trigger sample with the per-sample search it replaced (baseline)
+ * and with a plain below-level / above-margin hysteresis search, then
+ * line frames up on the crossing found by trigger_align().
+ */
+#define RING		SAMPLES_NR
+#define PRE		(SAMPLES_NR / 2)
+#define POST		(SAMPLES_NR / 2)
+#define STREAM_NR	4000
+#define NONE		(-1)
+
+extern struct trigger trig;
+
+__IO DMA_InitTypeDef DMA_struct;
+__IO struct scope dso_scope;
+struct waveform wave;
+
+static U16 stream[STREAM_NR];
+
+/* Not decimated, trigger_fire() doesn't get here */
+U16 peak_index(U16 cndtr)
+{
+	return 0;
+}
+
+struct replay {
+	S32 armed;		/* Stream index where the pre-fill ended */
+	S32 fired;		/* Stream index of the trigger sample */
+	S32 done;		/* Stream index of the last post sample */
+	U8 timeout;
+};
+
+/* The TIM2 update interrupt, see TIM2_IRQHandler() */
+static void replay_tim2(struct replay *r, S32 n)
+{
+	switch(trig.state) {
+	case TRIG_PRE_FILL:
+		r->armed = n;
+		trigger_arm();
+		break;
+	case TRIG_ARMING:
+	case TRIG_ARMED:
+		r->timeout = 1;
+		r->fired = n;
+		trigger_fire();
+		break;
+	case TRIG_POST:
+		r->done = n;
+		trig.state = TRIG_IDLE;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Per conversion: DMA stores it, TIM2 counts it, the watchdog checks it */
+static void replay(struct replay *r, U16 level, U16 timeout)
+{
+	S32 n;
+	U16 x;
+
+	r->armed = r->fired = r->done = NONE;
+	r->timeout = 0;
+
+	DMA_struct.DMA_BufferSize = RING;
+	DMA1_Channel1->CNDTR = RING;
+	trigger_config();
+	trigger_start(level, PRE, POST, timeout, 1);
+
+	for(n = 0; n < STREAM_NR && r->done == NONE; ++n) {
+		x = stream[n];
+		wave.tmp_buf[RING - DMA1_Channel1->CNDTR] = x;
+		if(!--DMA1_Channel1->CNDTR)
+			DMA1_Channel1->CNDTR = RING;
+
+		if(TIM2->CR1 & TIM_CR1_CEN) {
+			if(TIM2->CNT == TIM2->ARR) {
+				TIM2->CNT = 0;
+				if(TIM2->CR1 & TIM_CR1_OPM)
+					TIM2->CR1 &= ~TIM_CR1_CEN;
+				replay_tim2(r, n);
+			} else
+				TIM2->CNT++;
+		}
+
+		if((ADC1->CR1 & ADC_CR1_AWDIE) && (x > ADC1->HTR || x < ADC1->LTR))
+			if(trigger_awd_event())
+				r->fired = n;
+	}
+}
+
+/*
+ * [from] is the sample the watchdog was armed on, it is already checked
+ * against the arming window.
+ */
+
+/* The search the watchdog replaced: one step from below the level to above the margin */
+static S32 ref_baseline(S32 from, U16 level)
+{
+	S32 n;
+
+	for(n = from + 1; n < STREAM_NR; ++n)
+		if(stream[n - 1] < level && stream[n] > level + NOISE_MARGIN)
+			return n;
+	return NONE;
+}
+
+static S32 ref_hysteresis(S32 from, U16 level)
+{
+	S32 n;
+	U8 below = 0;
+
+	for(n = from; n < STREAM_NR; ++n) {
+		if(below && stream[n] > level + NOISE_MARGIN)
+			return n;
+		if(stream[n] < level)
+			below = 1;
+	}
+	return NONE;
+}
+
+static void check_fired(struct replay *r, S32 ref)
+{
+	CHECK(r->armed == PRE - 1);
+	CHECK(!r->timeout);
+	CHECK(r->fired == ref);
+	if(r->fired == NONE)
+		return;
+	CHECK(trig.index == r->fired % RING);
+	CHECK(wave.tmp_buf[trig.index] == stream[r->fired]);
+	CHECK(r->done == r->fired + POST);
+}
+
+/* Square waves with one-sample edges: same trigger sample as the baseline */
+static void test_square(void)
+{
+	struct replay r;
+	U16 level;
+	S32 n, period;
+
+	srand(1);
+	for(level = 200; level < 3800; level += 300) {
+		period = 20 + rand() % 60;
+		for(n = 0; n < STREAM_NR; ++n)
+			stream[n] = ((n + level) % period < period / 2 ? 100 : 3900) + rand() % 16;
+
+		replay(&r, level, 0);
+		CHECK(r.fired == ref_baseline(r.armed, level));
+		check_fired(&r, ref_hysteresis(r.armed, level));
+	}
+}
+
+/* Slow sine: fires on the margin, the crossing is found by trigger_align() */
+static void test_sine(void)
+{
+	struct replay r;
+	U16 level = 2048, frame[SAMPLES_NR];
+	S32 n, at, expect;
+	double period = 97.3, phase, t;
+
+	for(phase = 0; phase < 1; phase += 0.125) {
+		for(n = 0; n < STREAM_NR; ++n)
+			stream[n] = lround(2048 + 1000 * sin(2 * M_PI * (n / period + phase)));
+
+		replay(&r, level, 0);
+		check_fired(&r, ref_hysteresis(r.armed, level));
+		if(r.fired == NONE)
+			continue;
+
+		for(n = 0; n < SAMPLES_NR; ++n)
+			frame[n] = stream[r.fired - PRE + n];
+		at = trigger_align(frame, PRE, 0);
+
+		/* Zero crossing before the trigger sample */
+		t = (floor(r.fired / period + phase) - phase) * period;
+		expect = lround((t - r.fired) * MEAS_FRAC);
+		CHECK(at < 0);
+		CHECK(abs(at - expect) < MEAS_FRAC / 10);
+	}
+}
+
+/*
+ * Frames with the crossing a fraction of a sample before the trigger
+ * sample, with and without average fraction bits: trigger_shift() has to
+ * put the crossing on the trigger sample.
+ */
+static void test_shift(void)
+{
+	U16 frame[SAMPLES_NR], same[SAMPLES_NR];
+	S32 n, at;
+	double period = 41.3, x, ideal;
+	U8 shift;
+
+	trig.level = 2048;
+	for(shift = 0; shift <= 2; shift += 2)
+		for(x = 0.05; x < 3; x += 0.37) {
+			for(n = 0; n < SAMPLES_NR; ++n)
+				frame[n] = lround((2048 + 1500 * sin(2 * M_PI * (n - PRE + x) / period)) * (1 << shift));
+			at = trigger_align(frame, PRE, shift);
+			CHECK(abs(at + lround(x * MEAS_FRAC)) < MEAS_FRAC / 20);
+
+			trigger_shift(frame, at);
+			/* Linear interpolation of the sine is off by up to ~4 */
+			for(n = 4; n < SAMPLES_NR; ++n) {
+				ideal = (2048 + 1500 * sin(2 * M_PI * (n - PRE) / period)) * (1 << shift);
+				CHECK(fabs(frame[n] - ideal) < 6 << shift);
+			}
+		}
+
+	/* No edge found, nothing moves */
+	for(n = 0; n < SAMPLES_NR; ++n)
+		same[n] = frame[n] = n;
+	trigger_shift(frame, 0);
+	CHECK(!memcmp(frame, same, sizeof(frame)));
+}
+
+/* Noise around the level never gets past the margin, auto mode times out */
+static void test_noise(void)
+{
+	struct replay r;
+	S32 n;
+
+	srand(2);
+	for(n = 0; n < STREAM_NR; ++n)
+		stream[n] = 2000 - NOISE_MARGIN / 2 + rand() % NOISE_MARGIN;
+
+	replay(&r, 2000, 0);
+	CHECK(r.fired == NONE);
+	CHECK(ref_baseline(r.armed, 2000) == NONE);
+
+	replay(&r, 2000, TRIG_TIMEOUT(SAMPLES_NR));
+	CHECK(r.timeout);
+	CHECK(r.fired == r.armed + TRIG_TIMEOUT(SAMPLES_NR));
+	CHECK(r.done == r.fired + POST);
+}
+
+int main(void)
+{
+	test_square();
+	test_sine();
+	test_shift();
+	test_noise();
+	return host_result("trigger");
+}
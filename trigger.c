@@ -0,0 +1,186 @@
+#include "stm32f10x.h"
+
+#include "trigger.h"
+#include "scope.h"
+#include "peak.h"
+#include "measure.h"
+#include "Common.h"
+
+struct trigger trig;
+
+extern __IO DMA_InitTypeDef DMA_struct;
+extern __IO struct scope dso_scope;
+
+/* Configure the analog watchdog and the timeout counter */
+void trigger_config(void)
+{
+	TIM_TimeBaseInitTypeDef TIM_struct;
+
+	/* Watch the sampled channel only, interrupt is enabled when armed */
+	ADC_AnalogWatchdogSingleChannelConfig(ADC1, TRIG_CHANNEL);
+	ADC_AnalogWatchdogThresholdsConfig(ADC1, ADC_MAX, 0);
+	ADC_AnalogWatchdogCmd(ADC1, ADC_AnalogWatchdog_SingleRegEnable);
+	ADC_ITConfig(ADC1, ADC_IT_AWD, DISABLE);
+
+	/* TIM2 counts TIM3 update events (ITR2), i.e. ADC conversions */
+	TIM_TimeBaseStructInit(&TIM_struct);
+	TIM_struct.TIM_Period = 0xFFFF;
+	TIM_struct.TIM_Prescaler = 0;
+	TIM_struct.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_TimeBaseInit(TIM2, &TIM_struct);
+	TIM_ITRxExternalClockConfig(TIM2, TIM_TS_ITR2);
+	TIM_SelectOnePulseMode(TIM2, TIM_OPMode_Single);
+
+	TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+	TIM_ITConfig(TIM2, TIM_IT_Update, ENABLE);
+
+	trig.state = TRIG_IDLE;
+}
+
+/* Count down [samples] conversions, TIM2_IRQHandler is called when done */
+static void trigger_timer_start(U16 samples)
+{
+	TIM_Cmd(TIM2, DISABLE);
+	TIM_SetCounter(TIM2, 0);
+	TIM_SetAutoreload(TIM2, samples - 1);
+	TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+	TIM_Cmd(TIM2, ENABLE);
+}
+
+/*
+ * Start a new trigger search. The ring is filled with [pre] entries
+ * before the watchdog is armed so the whole pre-trigger part is valid.
+ * Every ring entry takes [decim] conversions.
+ */
+void trigger_start(U16 level, U16 pre, U16 post, U16 timeout, U16 decim)
+{
+	if(level > ADC_MAX - NOISE_MARGIN)
+		level = ADC_MAX - NOISE_MARGIN;
+
+	trig.level = level;
+	trig.pre = pre;
+	trig.post = post;
+	trig.timeout = timeout;
+	trig.decim = decim;
+
+	if(pre) {
+		trig.state = TRIG_PRE_FILL;
+		trigger_timer_start(pre * decim);
+	} else
+		trigger_arm();
+}
+
+/* Look for a rising edge through the trigger level */
+void trigger_arm(void)
+{
+	trig.state = TRIG_ARMING;
+
+	/* Wait for the signal to go below the trigger level first */
+	ADC_AnalogWatchdogThresholdsConfig(ADC1, ADC_MAX, trig.level);
+	ADC_ClearITPendingBit(ADC1, ADC_IT_AWD);
+	ADC_ITConfig(ADC1, ADC_IT_AWD, ENABLE);
+
+	if(trig.timeout)
+		trigger_timer_start(trig.timeout * trig.decim);
+	else
+		TIM_Cmd(TIM2, DISABLE);
+}
+
+/* Latch the trigger position and count the post-trigger samples */
+void trigger_fire(void)
+{
+	U16 len = DMA_struct.DMA_BufferSize;
+	U16 cndtr = DMA_GetCurrDataCounter(DMA1_Channel1);
+	U16 next = len - cndtr;
+
+	ADC_ITConfig(ADC1, ADC_IT_AWD, DISABLE);
+	trig.state = TRIG_POST;
+
+	if(ACQ_DECIMATED(dso_scope.acq_mode)) {
+		/*
+		 * The trigger pixel is still being filled. Its end and the last
+		 * post pixel are at most (post + 1) * decim - 1 conversions away,
+		 * one more makes sure the last half has been reduced.
+		 */
+		trig.index = peak_index(cndtr);
+		trigger_timer_start((trig.post + 1) * trig.decim);
+		return;
+	}
+
+	/* The trigger sample is the last one DMA wrote */
+	trig.index = next ? next - 1 : len - 1;
+
+	trigger_timer_start(trig.post);
+}
+
+void trigger_disarm(void)
+{
+	ADC_ITConfig(ADC1, ADC_IT_AWD, DISABLE);
+	TIM_Cmd(TIM2, DISABLE);
+	trig.state = TRIG_IDLE;
+}
+
+/* Called from the ADC interrupt, returns 1 when the trigger fired */
+U8 trigger_awd_event(void)
+{
+	switch(trig.state) {
+	case TRIG_ARMING:
+		/* Below the level, now wait for it to rise past the noise margin */
+		ADC_AnalogWatchdogThresholdsConfig(ADC1, trig.level + NOISE_MARGIN, 0);
+		trig.state = TRIG_ARMED;
+		break;
+	case TRIG_ARMED:
+		trigger_fire();
+		return 1;
+	default:
+		ADC_ITConfig(ADC1, ADC_IT_AWD, DISABLE);
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * The watchdog interrupt comes some samples after the signal crossed the
+ * level, a few more at fast timebases. Find the crossing before frame
+ * sample [at] of [buf] (samples with [shift] fraction bits) and return
+ * where it is relative to [at], in 1/MEAS_FRAC samples, 0 if not found.
+ */
+S16 trigger_align(__IO U16 *buf, U16 at, U8 shift)
+{
+	U16 level = trig.level << shift, i;
+
+	if(at >= SAMPLES_NR)
+		return 0;
+
+	for(i = at; i && i + TRIG_ALIGN_MAX > at; --i)
+		if(buf[i - 1] < level && buf[i] >= level)
+			return (S32)meas_cross(buf[i - 1], buf[i], level, i) - ((S32)at << MEAS_FRAC_BITS);
+
+	return 0;
+}
+
+/*
+ * Move frame [buf] later by -[d] 1/MEAS_FRAC samples, the offset from
+ * trigger_align(), interpolating linearly. The first samples repeat
+ * sample 0.
+ */
+void trigger_shift(__IO U16 *buf, S16 d)
+{
+	S32 pos;
+	U16 j, k, f;
+
+	/* The edge is never after the trigger sample */
+	if(d >= 0)
+		return;
+
+	/* Sample j takes the value from j + d, earlier, so go down */
+	for(j = SAMPLES_NR; j--; ) {
+		pos = ((S32)j << MEAS_FRAC_BITS) + d;
+		if(pos < 0)
+			pos = 0;
+		k = pos >> MEAS_FRAC_BITS;
+		f = pos & (MEAS_FRAC - 1);
+		buf[j] = ((U32)buf[k] * (MEAS_FRAC - f) + (U32)buf[k + 1] * f + MEAS_FRAC / 2) >> MEAS_FRAC_BITS;
+	}
+}
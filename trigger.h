@@ -0,0 +1,53 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+
+/*
+ * Rising edge trigger built on the ADC1 analog watchdog.
+ *
+ * DMA runs continuously into a ring while the trigger is searched for.
+ * TIM2 counts conversions so every phase ends on an exact sample count:
+ *	TRIG_PRE_FILL - collect the pre-trigger samples before arming
+ *	TRIG_ARMING   - window is [trig_lvl, ADC_MAX], fires once the signal is below the level
+ *	TRIG_ARMED    - window is [0, trig_lvl + NOISE_MARGIN], fires on the rising edge
+ *	TRIG_POST     - collect the post-trigger samples, then the frame is complete
+ */
+#define TRIG_CHANNEL		ADC_Channel_4
+
+/* Auto (real time) mode timeout, in ring entries. About 12.5 divisions. */
+#define TRIG_TIMEOUT(n)		((n) + (n) / 24)
+
+/* Frame samples before the trigger sample searched for the level crossing */
+#define TRIG_ALIGN_MAX		16
+
+typedef enum {
+	TRIG_IDLE = 0,
+	TRIG_PRE_FILL,
+	TRIG_ARMING,
+	TRIG_ARMED,
+	TRIG_POST
+} trig_state;
+
+struct trigger {
+	__IO trig_state state;
+	__IO U16 level;		/* ADC value latched when the search was started */
+	__IO U16 index;		/* Ring index of the trigger sample */
+	U16 pre;		/* Samples kept before the trigger */
+	U16 post;		/* Samples captured after the trigger */
+	U16 timeout;		/* Auto mode timeout, 0 waits forever */
+	U16 decim;		/* Conversions per ring entry, >1 in the decimated modes */
+};
+
+void trigger_config(void);
+void trigger_start(U16 level, U16 pre, U16 post, U16 timeout, U16 decim);
+void trigger_arm(void);
+void trigger_fire(void);
+void trigger_disarm(void);
+U8 trigger_awd_event(void);
+S16 trigger_align(__IO U16 *buf, U16 at, U8 shift);
+void trigger_shift(__IO U16 *buf, S16 d);
+
+#endif
@@ -0,0 +1,172 @@
+#include "stm32f10x.h"
+
+#include "uart.h"
+#include "scope.h"
+#include "loop.h"
+#include "Board.h"
+#include "Common.h"
+#include "string.h"
+
+struct uart uart;
+
+void uart_config(void)
+{
+	uart.rx_head = uart.rx_tail = 0;
+	uart.rx_lost = 0;
+	uart.state = RX_SYNC;
+	uart.crc_errors = 0;
+	memset(uart.done, 0, sizeof(uart.done));
+}
+
+/* Receive interrupt */
+void uart_rx(U8 b)
+{
+	U8 head = uart.rx_head;
+
+	if((U8)(head - uart.rx_tail) == UART_RX_LEN) {
+		++uart.rx_lost;
+		return;
+	}
+
+	uart.rx[head & (UART_RX_LEN - 1)] = b;
+	uart.rx_head = head + 1;
+
+	/* uart_poll() drains the ring, one event per batch */
+	if(head == uart.rx_tail)
+		loop_post(EV_SERIAL, 0);
+}
+
+/* A frame is complete, check it and hand it over */
+static void uart_frame(void)
+{
+	if(uart.crc != uart.crc_rx) {
+		++uart.crc_errors;
+		uart_nak(uart.seq, PROTO_ERR_CRC);
+		return;
+	}
+
+	if(uart.type == PROTO_RESET) {
+		memset(uart.done, 0, sizeof(uart.done));
+		uart_ack(uart.seq);
+		return;
+	}
+
+	/* Sent again, the ACK was lost. The waveform and stats are sent again. */
+	if(uart.type != PROTO_SEND_WF && uart.type != PROTO_SEND_STATS &&
+			BitTest(uart.done[uart.seq >> 3], (1 << (uart.seq & 7)))) {
+		uart_ack(uart.seq);
+		return;
+	}
+
+	scope_command(uart.type, uart.seq);
+}
+
+static void uart_parse(U8 b)
+{
+	if(uart.state != RX_SYNC && uart.state < RX_CRC_LO)
+		uart.crc = proto_crc16(uart.crc, b);
+
+	switch(uart.state) {
+	case RX_SYNC:
+		if(b == PROTO_SYNC) {
+			uart.crc = PROTO_CRC_INIT;
+			uart.state = RX_LEN_LO;
+		}
+		break;
+	case RX_LEN_LO:
+		uart.len = b;
+		uart.state = RX_LEN_HI;
+		break;
+	case RX_LEN_HI:
+		uart.len |= (U16)b << 8;
+		uart.state = RX_TYPE;
+		break;
+	case RX_TYPE:
+		uart.type = b;
+		uart.state = RX_SEQ;
+		break;
+	case RX_SEQ:
+		uart.seq = b;
+		uart.got = 0;
+		/* A bad length can't be skipped reliably, hunt for the next sync */
+		if(uart.len > PROTO_CMD_MAX) {
+			uart_nak(uart.seq, PROTO_ERR_LEN);
+			uart.state = RX_SYNC;
+		} else
+			uart.state = uart.len ? RX_PAYLOAD : RX_CRC_LO;
+		break;
+	case RX_PAYLOAD:
+		uart.payload[uart.got++] = b;
+		if(uart.got == uart.len)
+			uart.state = RX_CRC_LO;
+		break;
+	case RX_CRC_LO:
+		uart.crc_rx = b;
+		uart.state = RX_CRC_HI;
+		break;
+	case RX_CRC_HI:
+		uart.crc_rx |= (U16)b << 8;
+		uart.state = RX_SYNC;
+		uart_frame();
+		break;
+	}
+}
+
+/* Main loop, EV_SERIAL */
+void uart_poll(void)
+{
+	U8 tail;
+
+	while((tail = uart.rx_tail) != uart.rx_head) {
+		U8 b = uart.rx[tail & (UART_RX_LEN - 1)];
+
+		uart.rx_tail = tail + 1;
+		uart_parse(b);
+	}
+}
+
+void uart_frame_start(U8 type, U8 seq, U16 len)
+{
+	UartPutc(PROTO_SYNC, USART1);
+	uart.tx_crc = PROTO_CRC_INIT;
+	uart_frame_putU16(len);
+	uart_frame_put(type);
+	uart_frame_put(seq);
+}
+
+void uart_frame_put(U8 b)
+{
+	uart.tx_crc = proto_crc16(uart.tx_crc, b);
+	UartPutc(b, USART1);
+}
+
+void uart_frame_putU16(U16 data)
+{
+	uart_frame_put((U8) data);
+	uart_frame_put(data >> 8);
+}
+
+void uart_frame_end(void)
+{
+	uputU16(uart.tx_crc, USART1);
+}
+
+/* The command ran. Half the sequence space ahead is forgotten, the host
+ * never has that many commands unanswered. */
+void uart_ack(U8 seq)
+{
+	U8 old = seq + 128;
+
+	BitSet(uart.done[seq >> 3], (1 << (seq & 7)));
+	BitClr(uart.done[old >> 3], (1 << (old & 7)));
+
+	uart_frame_start(PROTO_ACK, seq, 0);
+	uart_frame_end();
+}
+
+void uart_nak(U8 seq, U8 err)
+{
+	uart_frame_start(PROTO_NAK, seq, 1);
+	uart_frame_put(err);
+	uart_frame_end();
+}
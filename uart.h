@@ -0,0 +1,69 @@
+#ifndef UART_H
+#define UART_H
+
+#include "stm32f10x.h"
+
+#include "Common.h"
+#include "protocol.h"
+
+/*
+ * USART1 host link, the frames are described in protocol.h.
+ *
+ * The receive interrupt only stores the bytes in the rx ring and posts
+ * EV_SERIAL when the ring was empty. uart_poll() drains the ring from the
+ * main loop through the frame parser and hands every frame with a good
+ * CRC to scope_command(). The ring holds PROTO_WINDOW command frames, a
+ * byte that doesn't fit is dropped and the host times the frame out.
+ *
+ * The answers are sent from the main loop, uart_frame_start() to
+ * uart_frame_end() stream one frame with a running CRC.
+ */
+#define UART_RX_LEN		128	/* Ring size, a power of 2 below 256 */
+
+#if UART_RX_LEN < PROTO_WINDOW * (PROTO_HDR_LEN + PROTO_CRC_LEN)
+#error "UART_RX_LEN doesn't hold PROTO_WINDOW commands"
+#endif
+
+enum uart_rx_state {
+	RX_SYNC,
+	RX_LEN_LO,
+	RX_LEN_HI,
+	RX_TYPE,
+	RX_SEQ,
+	RX_PAYLOAD,
+	RX_CRC_LO,
+	RX_CRC_HI
+};
+
+struct uart {
+	__IO U8 rx[UART_RX_LEN];
+	__IO U8 rx_head;		/* Receive interrupt only */
+	__IO U8 rx_tail;		/* uart_poll() only */
+	__IO U8 rx_lost;		/* Bytes dropped, ring full */
+
+	/* Frame parser */
+	U8 state;
+	U16 len;
+	U16 got;
+	U8 type;
+	U8 seq;
+	U8 payload[PROTO_CMD_MAX];
+	U16 crc;
+	U16 crc_rx;
+	U16 crc_errors;
+	U8 done[256 / 8];		/* Acknowledged sequence numbers */
+
+	U16 tx_crc;			/* Running CRC of the frame being sent */
+};
+
+void uart_config(void);
+void uart_rx(U8 b);
+void uart_poll(void);
+void uart_frame_start(U8 type, U8 seq, U16 len);
+void uart_frame_put(U8 b);
+void uart_frame_putU16(U16 data);
+void uart_frame_end(void);
+void uart_ack(U8 seq);
+void uart_nak(U8 seq, U8 err);
+
+#endif